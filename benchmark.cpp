@@ -0,0 +1,118 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+namespace cg {
+namespace {
+double percentile(const std::vector<double> &sorted, double fraction) {
+  const double count = static_cast<double>(sorted.size());
+  const size_t rank = static_cast<size_t>(std::ceil(fraction * count));
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+std::string escapeJson(const std::string &value) {
+  std::string escaped;
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    if (static_cast<unsigned char>(c) < 0x20) {
+      continue;
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+void printRow(const char *name, const Percentiles &p, std::ostream &out) {
+  out << std::left << std::setw(12) << name << std::right << std::fixed
+      << std::setprecision(3) << std::setw(10) << p.min << std::setw(10)
+      << p.p50 << std::setw(10) << p.p95 << std::setw(10) << p.p99
+      << std::setw(10) << p.max << '\n';
+}
+
+void writeMetric(const char *name, const Percentiles &p, bool last,
+                 std::ostream &out) {
+  out << "    \"" << name << "\": {\"min\": " << p.min << ", \"p50\": " << p.p50
+      << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99
+      << ", \"max\": " << p.max << "}" << (last ? "\n" : ",\n");
+}
+} // namespace
+
+Percentiles computePercentiles(std::vector<double> samples) {
+  if (samples.empty()) {
+    return {};
+  }
+  std::sort(samples.begin(), samples.end());
+  return {
+      .min = samples.front(),
+      .p50 = percentile(samples, 0.50),
+      .p95 = percentile(samples, 0.95),
+      .p99 = percentile(samples, 0.99),
+      .max = samples.back(),
+  };
+}
+
+void FrameStatistics::add(const FrameTimings &timings) {
+  cpu_frame_ms_.push_back(timings.cpu_frame_ms);
+  fence_wait_ms_.push_back(timings.fence_wait_ms);
+  acquire_ms_.push_back(timings.acquire_ms);
+  submit_ms_.push_back(timings.submit_ms);
+  present_ms_.push_back(timings.present_ms);
+  if (timings.gpu_ms.has_value()) {
+    gpu_ms_.push_back(timings.gpu_ms.value());
+  }
+}
+
+void printBenchmarkSummary(const BenchmarkReport &report, std::ostream &out) {
+  const FrameStatistics &stats = report.statistics;
+  out << "device: " << report.device_name << '\n'
+      << "frames: " << stats.frameCount() << " (warmup "
+      << report.warmup_frames << ", in flight " << report.frames_in_flight
+      << (report.headless ? ", headless" : "") << ")\n";
+  if (report.wall_seconds > 0.0) {
+    out << "throughput: " << std::fixed << std::setprecision(1)
+        << stats.frameCount() / report.wall_seconds << " frames/s\n";
+  }
+  out << std::left << std::setw(12) << "ms" << std::right << std::setw(10)
+      << "min" << std::setw(10) << "p50" << std::setw(10) << "p95"
+      << std::setw(10) << "p99" << std::setw(10) << "max" << '\n';
+  printRow("cpu frame", stats.cpuFrame(), out);
+  printRow("fence wait", stats.fenceWait(), out);
+  printRow("acquire", stats.acquire(), out);
+  printRow("submit", stats.submit(), out);
+  printRow("present", stats.present(), out);
+  if (stats.gpuSampleCount() > 0) {
+    printRow("gpu", stats.gpu(), out);
+  } else {
+    out << "gpu: timestamps unsupported\n";
+  }
+}
+
+void writeBenchmarkJson(const BenchmarkReport &report, std::ostream &out) {
+  const FrameStatistics &stats = report.statistics;
+  const double fps = report.wall_seconds > 0.0
+                         ? stats.frameCount() / report.wall_seconds
+                         : 0.0;
+  out << std::setprecision(6) << std::fixed;
+  out << "{\n"
+      << "  \"device\": \"" << escapeJson(report.device_name) << "\",\n"
+      << "  \"headless\": " << (report.headless ? "true" : "false") << ",\n"
+      << "  \"frames_in_flight\": " << report.frames_in_flight << ",\n"
+      << "  \"warmup_frames\": " << report.warmup_frames << ",\n"
+      << "  \"frames\": " << stats.frameCount() << ",\n"
+      << "  \"gpu_samples\": " << stats.gpuSampleCount() << ",\n"
+      << "  \"wall_seconds\": " << report.wall_seconds << ",\n"
+      << "  \"frames_per_second\": " << fps << ",\n"
+      << "  \"milliseconds\": {\n";
+  writeMetric("cpu_frame", stats.cpuFrame(), false, out);
+  writeMetric("fence_wait", stats.fenceWait(), false, out);
+  writeMetric("acquire", stats.acquire(), false, out);
+  writeMetric("submit", stats.submit(), false, out);
+  writeMetric("present", stats.present(), false, out);
+  writeMetric("gpu", stats.gpu(), true, out);
+  out << "  }\n}\n";
+}
+} // namespace cg
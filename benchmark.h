@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cg {
+// Wall-clock cost of one drawFrame() call and of the blocking calls inside
+// it, in milliseconds.
+struct FrameTimings {
+  double cpu_frame_ms = 0.0;
+  double fence_wait_ms = 0.0;
+  double acquire_ms = 0.0;
+  double submit_ms = 0.0;
+  double present_ms = 0.0;
+  // GPU execution time of the frame that last used the same ring slot; empty
+  // until that frame's timestamps are available.
+  std::optional<double> gpu_ms;
+};
+
+struct Percentiles {
+  double min = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+// Nearest-rank percentiles; all zero for an empty sample set.
+Percentiles computePercentiles(std::vector<double> samples);
+
+class FrameStatistics {
+public:
+  void add(const FrameTimings &timings);
+
+  size_t frameCount() const { return cpu_frame_ms_.size(); }
+
+  Percentiles cpuFrame() const { return computePercentiles(cpu_frame_ms_); }
+  Percentiles fenceWait() const { return computePercentiles(fence_wait_ms_); }
+  Percentiles acquire() const { return computePercentiles(acquire_ms_); }
+  Percentiles submit() const { return computePercentiles(submit_ms_); }
+  Percentiles present() const { return computePercentiles(present_ms_); }
+  Percentiles gpu() const { return computePercentiles(gpu_ms_); }
+  size_t gpuSampleCount() const { return gpu_ms_.size(); }
+
+private:
+  std::vector<double> cpu_frame_ms_;
+  std::vector<double> fence_wait_ms_;
+  std::vector<double> acquire_ms_;
+  std::vector<double> submit_ms_;
+  std::vector<double> present_ms_;
+  std::vector<double> gpu_ms_;
+};
+
+struct BenchmarkReport {
+  std::string device_name;
+  bool headless = false;
+  uint32_t frames_in_flight = 0;
+  uint32_t warmup_frames = 0;
+  double wall_seconds = 0.0;
+  FrameStatistics statistics;
+};
+
+void printBenchmarkSummary(const BenchmarkReport &report, std::ostream &out);
+
+void writeBenchmarkJson(const BenchmarkReport &report, std::ostream &out);
+} // namespace cg
@@ -0,0 +1,192 @@
+#include "bindless.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+constexpr uint32_t kTextureBinding = 0;
+constexpr uint32_t kMaterialBinding = 1;
+
+VkDescriptorSetLayout createBindlessSetLayout(uint32_t texture_capacity,
+                                              const VkDevice &device) {
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+  bindings[0].binding = kTextureBinding;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = texture_capacity;
+  bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  bindings[1].binding = kMaterialBinding;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  // Texture slots are written while the set is bound in command buffers
+  // still pending, which never read the slots being written, and most of
+  // them are never written at all.
+  const std::array<VkDescriptorBindingFlags, 2> binding_flags = {
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+          VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+      0,
+  };
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+  flags_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  flags_info.bindingCount = static_cast<uint32_t>(binding_flags.size());
+  flags_info.pBindingFlags = binding_flags.data();
+
+  VkDescriptorSetLayoutCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  info.pNext = &flags_info;
+  info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  info.bindingCount = static_cast<uint32_t>(bindings.size());
+  info.pBindings = bindings.data();
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(device, &info, nullptr, &layout) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor set layout!");
+  }
+  return layout;
+}
+
+VkDescriptorPool createBindlessPool(uint32_t texture_capacity,
+                                    const VkDevice &device) {
+  const std::array<VkDescriptorPoolSize, 2> sizes = {{
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture_capacity},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
+  }};
+  VkDescriptorPoolCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  info.maxSets = 1;
+  info.poolSizeCount = static_cast<uint32_t>(sizes.size());
+  info.pPoolSizes = sizes.data();
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(device, &info, nullptr, &pool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor pool!");
+  }
+  return pool;
+}
+} // namespace
+
+SlotAllocator::SlotAllocator(uint32_t capacity, uint32_t frame_count)
+    : capacity_(capacity), pending_(frame_count) {}
+
+void SlotAllocator::beginFrame(uint32_t frame_index) {
+  std::vector<uint32_t> &pending = pending_[frame_index];
+  free_.insert(free_.end(), pending.begin(), pending.end());
+  pending.clear();
+  current_frame_ = frame_index;
+}
+
+uint32_t SlotAllocator::allocate() {
+  if (!free_.empty()) {
+    const uint32_t slot = free_.back();
+    free_.pop_back();
+    return slot;
+  }
+  if (next_ == capacity_) {
+    throw std::runtime_error("out of descriptor slots!");
+  }
+  return next_++;
+}
+
+void SlotAllocator::free(uint32_t slot) {
+  pending_[current_frame_].push_back(slot);
+}
+
+BindlessTable::BindlessTable(DeviceAllocator &allocator, uint32_t frame_count,
+                             uint32_t texture_capacity,
+                             uint32_t material_capacity)
+    : device_(allocator.device()),
+      texture_slots_(texture_capacity, frame_count),
+      material_slots_(material_capacity, frame_count) {
+  set_layout_ = createBindlessSetLayout(texture_capacity, device_);
+  pool_ = createBindlessPool(texture_capacity, device_);
+
+  VkDescriptorSetAllocateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  info.descriptorPool = pool_;
+  info.descriptorSetCount = 1;
+  info.pSetLayouts = &set_layout_;
+  if (vkAllocateDescriptorSets(device_, &info, &set_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate descriptor set!");
+  }
+
+  materials_ = createBuffer(allocator, material_capacity * sizeof(Material),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  VkDescriptorBufferInfo buffer_info{};
+  buffer_info.buffer = materials_.buffer;
+  buffer_info.offset = 0;
+  buffer_info.range = VK_WHOLE_SIZE;
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set_;
+  write.dstBinding = kMaterialBinding;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &buffer_info;
+  vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+}
+
+void BindlessTable::destroy(DeviceAllocator &allocator) {
+  materials_.destroy(allocator);
+  vkDestroyDescriptorPool(device_, pool_, nullptr);
+  vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+}
+
+void BindlessTable::beginFrame(uint32_t frame_index) {
+  texture_slots_.beginFrame(frame_index);
+  material_slots_.beginFrame(frame_index);
+}
+
+uint32_t BindlessTable::addTexture(const VkImageView &view,
+                                   const VkSampler &sampler) {
+  const uint32_t slot = texture_slots_.allocate();
+  VkDescriptorImageInfo image_info{};
+  image_info.sampler = sampler;
+  image_info.imageView = view;
+  image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set_;
+  write.dstBinding = kTextureBinding;
+  write.dstArrayElement = slot;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &image_info;
+  vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  return slot;
+}
+
+void BindlessTable::removeTexture(uint32_t slot) { texture_slots_.free(slot); }
+
+uint32_t BindlessTable::addMaterial(DeviceAllocator &allocator,
+                                    const Material &material) {
+  const uint32_t slot = material_slots_.allocate();
+  updateMaterial(allocator, slot, material);
+  return slot;
+}
+
+void BindlessTable::updateMaterial(DeviceAllocator &allocator, uint32_t slot,
+                                   const Material &material) {
+  std::memcpy(static_cast<Material *>(materials_.allocation.mapped) + slot,
+              &material, sizeof(Material));
+  allocator.flush(materials_.allocation);
+}
+
+void BindlessTable::recordMaterialUpdate(VkCommandBuffer command_buffer,
+                                         uint32_t slot,
+                                         const Material &material) {
+  vkCmdUpdateBuffer(command_buffer, materials_.buffer, slot * sizeof(Material),
+                    sizeof(Material), &material);
+}
+
+void BindlessTable::removeMaterial(uint32_t slot) {
+  material_slots_.free(slot);
+}
+} // namespace cg
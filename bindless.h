@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+#include "device_memory.h"
+
+namespace cg {
+// Hands out indices in [0, capacity). Freed indices are only reused once the
+// frame slot that freed them comes around again, so frames still in flight
+// never see a slot change meaning.
+class SlotAllocator {
+public:
+  SlotAllocator() = default;
+  SlotAllocator(uint32_t capacity, uint32_t frame_count);
+
+  // Makes the slot's deferred frees reusable; call after waiting on its
+  // fence.
+  void beginFrame(uint32_t frame_index);
+  uint32_t allocate();
+  void free(uint32_t slot);
+
+private:
+  uint32_t capacity_ = 0;
+  uint32_t next_ = 0;
+  std::vector<uint32_t> free_;
+  std::vector<std::vector<uint32_t>> pending_;
+  uint32_t current_frame_ = 0;
+};
+
+// Matches the Material element of bindless.frag.
+struct Material {
+  float color[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+  uint32_t texture = 0;
+  uint32_t padding[3] = {};
+};
+
+// One descriptor set holding an update-after-bind array of every texture and
+// a storage buffer of every material, bound once per command buffer. Shaders
+// select them by index, so switching materials never rebinds anything.
+// Requires the descriptor indexing features of Vulkan 1.2.
+class BindlessTable {
+public:
+  BindlessTable(DeviceAllocator &allocator, uint32_t frame_count,
+                uint32_t texture_capacity = 4096,
+                uint32_t material_capacity = 4096);
+
+  void destroy(DeviceAllocator &allocator);
+
+  void beginFrame(uint32_t frame_index);
+
+  // The view and sampler must outlive the slot, including the frames in
+  // flight after removeTexture().
+  uint32_t addTexture(const VkImageView &view, const VkSampler &sampler);
+  void removeTexture(uint32_t slot);
+
+  // Updating a material in place is immediately visible to frames in
+  // flight; add a new one instead where that matters.
+  uint32_t addMaterial(DeviceAllocator &allocator, const Material &material);
+  void updateMaterial(DeviceAllocator &allocator, uint32_t slot,
+                      const Material &material);
+  // Records the update into command_buffer instead, so work submitted
+  // earlier still sees the old material. Must be recorded outside a render
+  // pass and made visible to the fragment shader with a barrier.
+  void recordMaterialUpdate(VkCommandBuffer command_buffer, uint32_t slot,
+                            const Material &material);
+  void removeMaterial(uint32_t slot);
+
+  const VkDescriptorSetLayout &setLayout() const { return set_layout_; }
+  const VkDescriptorSet &set() const { return set_; }
+
+private:
+  VkDevice device_;
+  VkDescriptorSetLayout set_layout_;
+  VkDescriptorPool pool_;
+  VkDescriptorSet set_;
+  Buffer materials_;
+  SlotAllocator texture_slots_;
+  SlotAllocator material_slots_;
+};
+} // namespace cg
@@ -0,0 +1,284 @@
+#include "buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+// Keeps every copy source suitably aligned for any buffer copy.
+constexpr VkDeviceSize kStagingAlignment = 16;
+} // namespace
+
+Buffer createBuffer(DeviceAllocator &allocator, VkDeviceSize size,
+                    VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+                    VkMemoryPropertyFlags preferred) {
+  VkBufferCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  info.size = size;
+  info.usage = usage;
+  info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  Buffer buffer;
+  buffer.size = size;
+  if (vkCreateBuffer(allocator.device(), &info, nullptr, &buffer.buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer!");
+  }
+  buffer.allocation =
+      allocator.allocateForBuffer(buffer.buffer, required, preferred);
+  return buffer;
+}
+
+VkCommandBuffer beginSingleTimeCommands(const VkCommandPool &pool,
+                                        const VkDevice &device) {
+  VkCommandBufferAllocateInfo allocate_info{};
+  allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocate_info.commandPool = pool;
+  allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocate_info.commandBufferCount = 1;
+  VkCommandBuffer buffer;
+  if (vkAllocateCommandBuffers(device, &allocate_info, &buffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate command buffer!");
+  }
+  VkCommandBufferBeginInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (vkBeginCommandBuffer(buffer, &info) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin recording command buffer!");
+  }
+  return buffer;
+}
+
+void endSingleTimeCommands(VkCommandBuffer buffer, const VkCommandPool &pool,
+                           const VkQueue &queue, const VkDevice &device) {
+  if (vkEndCommandBuffer(buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+  VkSubmitInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  info.commandBufferCount = 1;
+  info.pCommandBuffers = &buffer;
+  if (vkQueueSubmit(queue, 1, &info, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit command buffer!");
+  }
+  vkQueueWaitIdle(queue);
+  vkFreeCommandBuffers(device, pool, 1, &buffer);
+}
+
+void UploadBatch::add(const VkBuffer &dst, VkDeviceSize offset,
+                      const void *data, VkDeviceSize size) {
+  if (size == 0) {
+    return;
+  }
+  const VkDeviceSize staging_offset =
+      (staging_data_.size() + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+  staging_data_.resize(staging_offset + size);
+  std::memcpy(staging_data_.data() + staging_offset, data, size);
+  copies_.push_back({dst, {staging_offset, offset, size}});
+}
+
+void UploadBatch::addReference(const VkBuffer &dst, VkDeviceSize offset,
+                               const void *data, VkDeviceSize size) {
+  if (size == 0) {
+    return;
+  }
+  // The staging offset is assigned by submit().
+  copies_.push_back({dst, {0, offset, size}, data});
+}
+
+VkBufferMemoryBarrier
+getOwnershipTransferBarrier(const VkBuffer &buffer, VkDeviceSize offset,
+                            VkDeviceSize size, uint32_t src_family,
+                            uint32_t dst_family, VkAccessFlags src_access,
+                            VkAccessFlags dst_access) {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.srcQueueFamilyIndex = src_family;
+  barrier.dstQueueFamilyIndex = dst_family;
+  barrier.buffer = buffer;
+  barrier.offset = offset;
+  barrier.size = size;
+  return barrier;
+}
+
+void UploadBatch::submit(DeviceAllocator &allocator,
+                         const QueueContext &transfer,
+                         const QueueContext &graphics) {
+  if (empty()) {
+    return;
+  }
+  wait(allocator);
+  const VkDevice &device = allocator.device();
+  // Referenced data is staged after the owned data.
+  VkDeviceSize staging_size = staging_data_.size();
+  for (auto &copy : copies_) {
+    if (copy.source != nullptr) {
+      copy.region.srcOffset = (staging_size + kStagingAlignment - 1) &
+                              ~(kStagingAlignment - 1);
+      staging_size = copy.region.srcOffset + copy.region.size;
+    }
+  }
+  staging_ = createBuffer(allocator, staging_size,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  auto *staging = static_cast<uint8_t *>(staging_.allocation.mapped);
+  if (!staging_data_.empty()) {
+    std::memcpy(staging, staging_data_.data(), staging_data_.size());
+  }
+  for (const auto &copy : copies_) {
+    if (copy.source != nullptr) {
+      std::memcpy(staging + copy.region.srcOffset, copy.source,
+                  copy.region.size);
+    }
+  }
+  allocator.flush(staging_.allocation);
+  transfer_ = transfer;
+  graphics_ = graphics;
+
+  VkFenceCreateInfo fence_info{};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  if (vkCreateFence(device, &fence_info, nullptr, &fence_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload fence!");
+  }
+
+  const bool transfer_ownership = transfer.family != graphics.family;
+  std::vector<VkBufferMemoryBarrier> barriers;
+  transfer_commands_ = beginSingleTimeCommands(transfer.pool, device);
+  for (const auto &copy : copies_) {
+    vkCmdCopyBuffer(transfer_commands_, staging_.buffer, copy.dst, 1,
+                    &copy.region);
+    barriers.push_back(getOwnershipTransferBarrier(
+        copy.dst, copy.region.dstOffset, copy.region.size, transfer.family,
+        graphics.family, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_MEMORY_READ_BIT));
+  }
+  if (transfer_ownership) {
+    vkCmdPipelineBarrier(transfer_commands_, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data(), 0, nullptr);
+  } else {
+    // One queue family: make the writes visible to whatever this queue runs
+    // next.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(transfer_commands_, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+  }
+  if (vkEndCommandBuffer(transfer_commands_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+  staging_data_.clear();
+  copies_.clear();
+
+  VkSubmitInfo transfer_info{};
+  transfer_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  transfer_info.commandBufferCount = 1;
+  transfer_info.pCommandBuffers = &transfer_commands_;
+  if (!transfer_ownership) {
+    if (vkQueueSubmit(transfer.queue, 1, &transfer_info, fence_) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to submit upload!");
+    }
+    return;
+  }
+
+  VkSemaphoreCreateInfo semaphore_info{};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  if (vkCreateSemaphore(device, &semaphore_info, nullptr, &transferred_) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create upload semaphore!");
+  }
+  transfer_info.signalSemaphoreCount = 1;
+  transfer_info.pSignalSemaphores = &transferred_;
+  if (vkQueueSubmit(transfer.queue, 1, &transfer_info, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to submit upload!");
+  }
+
+  graphics_commands_ = beginSingleTimeCommands(graphics.pool, device);
+  vkCmdPipelineBarrier(graphics_commands_, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                       static_cast<uint32_t>(barriers.size()), barriers.data(),
+                       0, nullptr);
+  if (vkEndCommandBuffer(graphics_commands_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+  const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkSubmitInfo acquire_info{};
+  acquire_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  acquire_info.waitSemaphoreCount = 1;
+  acquire_info.pWaitSemaphores = &transferred_;
+  acquire_info.pWaitDstStageMask = &wait_stage;
+  acquire_info.commandBufferCount = 1;
+  acquire_info.pCommandBuffers = &graphics_commands_;
+  if (vkQueueSubmit(graphics.queue, 1, &acquire_info, fence_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit upload!");
+  }
+}
+
+bool UploadBatch::poll(DeviceAllocator &allocator) {
+  if (!pending()) {
+    return true;
+  }
+  if (vkGetFenceStatus(allocator.device(), fence_) != VK_SUCCESS) {
+    return false;
+  }
+  release(allocator);
+  return true;
+}
+
+void UploadBatch::wait(DeviceAllocator &allocator) {
+  if (!pending()) {
+    return;
+  }
+  vkWaitForFences(allocator.device(), 1, &fence_, VK_TRUE, UINT64_MAX);
+  release(allocator);
+}
+
+void UploadBatch::release(DeviceAllocator &allocator) {
+  const VkDevice &device = allocator.device();
+  vkFreeCommandBuffers(device, transfer_.pool, 1, &transfer_commands_);
+  if (graphics_commands_ != VK_NULL_HANDLE) {
+    vkFreeCommandBuffers(device, graphics_.pool, 1, &graphics_commands_);
+    vkDestroySemaphore(device, transferred_, nullptr);
+  }
+  vkDestroyFence(device, fence_, nullptr);
+  staging_.destroy(allocator);
+  transfer_commands_ = VK_NULL_HANDLE;
+  graphics_commands_ = VK_NULL_HANDLE;
+  transferred_ = VK_NULL_HANDLE;
+  fence_ = VK_NULL_HANDLE;
+  staging_ = {};
+}
+
+UniformRing::UniformRing(DeviceAllocator &allocator, VkDeviceSize capacity,
+                         uint32_t frame_count,
+                         VkDeviceSize min_offset_alignment)
+    : ring_(capacity, frame_count),
+      alignment_(std::max<VkDeviceSize>(min_offset_alignment, 1)) {
+  buffer_ = createBuffer(allocator, capacity,
+                         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+uint32_t UniformRing::push(DeviceAllocator &allocator, const void *data,
+                           VkDeviceSize size) {
+  const std::optional<VkDeviceSize> offset = ring_.allocate(size, alignment_);
+  if (!offset.has_value()) {
+    throw std::runtime_error("uniform ring is full!");
+  }
+  std::memcpy(static_cast<uint8_t *>(buffer_.allocation.mapped) + *offset,
+              data, size);
+  allocator.flush(buffer_.allocation);
+  return static_cast<uint32_t>(*offset);
+}
+} // namespace cg
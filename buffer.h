@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "device_memory.h"
+
+namespace cg {
+struct Buffer {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkDeviceSize size = 0;
+
+  void destroy(DeviceAllocator &allocator) {
+    vkDestroyBuffer(allocator.device(), buffer, nullptr);
+    allocator.free(allocation);
+  }
+};
+
+Buffer createBuffer(DeviceAllocator &allocator, VkDeviceSize size,
+                    VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+                    VkMemoryPropertyFlags preferred = 0);
+
+// A queue, the family it belongs to and a command pool for that family.
+struct QueueContext {
+  VkQueue queue = VK_NULL_HANDLE;
+  uint32_t family = 0;
+  VkCommandPool pool = VK_NULL_HANDLE;
+};
+
+VkCommandBuffer beginSingleTimeCommands(const VkCommandPool &pool,
+                                        const VkDevice &device);
+
+// Submits the command buffer, waits for it to complete and frees it.
+void endSingleTimeCommands(VkCommandBuffer buffer, const VkCommandPool &pool,
+                           const VkQueue &queue, const VkDevice &device);
+
+// Barrier moving a buffer range between queue families. The same barrier is
+// recorded twice: as the release on a src_family queue and as the acquire on
+// a dst_family queue, ordered by a semaphore. The release ignores dst_access
+// and the acquire ignores src_access.
+VkBufferMemoryBarrier
+getOwnershipTransferBarrier(const VkBuffer &buffer, VkDeviceSize offset,
+                            VkDeviceSize size, uint32_t src_family,
+                            uint32_t dst_family, VkAccessFlags src_access,
+                            VkAccessFlags dst_access);
+
+// Collects host data destined for device-local buffers and uploads all of it
+// through a single staging buffer and transfer queue submission.
+class UploadBatch {
+public:
+  // Copies size bytes of data to dst at offset when submit() runs. The data
+  // is copied immediately, so it need not outlive the call.
+  void add(const VkBuffer &dst, VkDeviceSize offset, const void *data,
+           VkDeviceSize size);
+  // Like add(), but data is only read by submit() and must stay valid until
+  // then. Data already in memory, e.g. a mapped file, then goes straight
+  // into the staging buffer.
+  void addReference(const VkBuffer &dst, VkDeviceSize offset,
+                    const void *data, VkDeviceSize size);
+
+  bool empty() const { return copies_.empty(); }
+  bool pending() const { return fence_ != VK_NULL_HANDLE; }
+
+  // Starts the copies on the transfer queue and returns without waiting.
+  // When the transfer family is not the graphics family, the destinations
+  // are released by the transfer queue and acquired by the graphics queue
+  // behind a semaphore, so graphics work submitted afterwards sees the data
+  // while earlier frames keep rendering. Waits for a previous submission
+  // still in flight.
+  void submit(DeviceAllocator &allocator, const QueueContext &transfer,
+              const QueueContext &graphics);
+  // Releases the staging resources once the upload has completed. Returns
+  // whether nothing is pending anymore.
+  bool poll(DeviceAllocator &allocator);
+  void wait(DeviceAllocator &allocator);
+
+private:
+  void release(DeviceAllocator &allocator);
+
+  struct Copy {
+    VkBuffer dst;
+    VkBufferCopy region;
+    // Caller-owned source of an addReference() copy, or null when the data
+    // is in staging_data_ at region.srcOffset.
+    const void *source = nullptr;
+  };
+  std::vector<uint8_t> staging_data_;
+  std::vector<Copy> copies_;
+
+  // Resources of the submission in flight.
+  Buffer staging_;
+  QueueContext transfer_;
+  QueueContext graphics_;
+  VkCommandBuffer transfer_commands_ = VK_NULL_HANDLE;
+  VkCommandBuffer graphics_commands_ = VK_NULL_HANDLE;
+  VkSemaphore transferred_ = VK_NULL_HANDLE;
+  VkFence fence_ = VK_NULL_HANDLE;
+};
+
+// Persistently mapped uniform buffer whose space is ring-allocated per frame
+// slot. Bind it once as VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC and select
+// the data with the offsets push() returns.
+class UniformRing {
+public:
+  UniformRing() = default;
+  UniformRing(DeviceAllocator &allocator, VkDeviceSize capacity,
+              uint32_t frame_count, VkDeviceSize min_offset_alignment);
+
+  // Reclaims the slot's previous data; call after waiting on its fence.
+  void beginFrame(uint32_t frame_index) { ring_.beginFrame(frame_index); }
+  // Copies size bytes of data into the ring and returns their offset.
+  uint32_t push(DeviceAllocator &allocator, const void *data,
+                VkDeviceSize size);
+  template <typename T>
+  uint32_t push(DeviceAllocator &allocator, const T &value) {
+    return push(allocator, &value, sizeof(T));
+  }
+
+  const VkBuffer &buffer() const { return buffer_.buffer; }
+
+  void destroy(DeviceAllocator &allocator) { buffer_.destroy(allocator); }
+
+private:
+  Buffer buffer_;
+  RingAllocator ring_{0, 1};
+  VkDeviceSize alignment_ = 1;
+};
+} // namespace cg
@@ -1,54 +1,88 @@
 #include "computer_graphics_application.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "shader/shader_utils.h"
+#include "buffer.h"
+#include "mesh_format.h"
 
 namespace cg {
 namespace {
-constexpr uint32_t kWidth = 800;
-constexpr uint32_t kHeight = 600;
+using Clock = std::chrono::steady_clock;
 
-GLFWwindow *initWindow() {
+double millisecondsSince(const Clock::time_point &start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+} // namespace
+
+namespace {
+GLFWwindow *initWindow(uint32_t width, uint32_t height) {
   glfwInit();
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-  return glfwCreateWindow(kWidth, kHeight, "Vulkan", nullptr, nullptr);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+  return glfwCreateWindow(static_cast<int>(width), static_cast<int>(height),
+                          "Vulkan", nullptr, nullptr);
 }
 } // namespace
 
 namespace {
-VkApplicationInfo getApplicationInfo() {
+// Vulkan 1.2, for descriptor indexing, or the loader's version if older: a
+// 1.0 loader rejects any newer apiVersion. Devices below 1.2 still work
+// without bindless rendering.
+uint32_t getInstanceApiVersion() {
+  // Only loaders newer than 1.0 export vkEnumerateInstanceVersion.
+  const auto enumerate_version =
+      reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+          vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+  uint32_t version = VK_API_VERSION_1_0;
+  if (enumerate_version == nullptr ||
+      enumerate_version(&version) != VK_SUCCESS) {
+    version = VK_API_VERSION_1_0;
+  }
+  return std::min(version, VK_API_VERSION_1_2);
+}
+
+VkApplicationInfo getApplicationInfo(uint32_t api_version) {
   VkApplicationInfo info{};
   info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
   info.pApplicationName = "Computer Graphics";
   info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   info.pEngineName = "SweetHome Engine";
   info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  info.apiVersion = VK_API_VERSION_1_0;
+  info.apiVersion = api_version;
   return info;
 }
 
-VkInstanceCreateInfo
-getInstanceCreateInfo(VkApplicationInfo *application_info) {
+VkInstanceCreateInfo getInstanceCreateInfo(VkApplicationInfo *application_info,
+                                           bool headless) {
   VkInstanceCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   info.pApplicationInfo = application_info;
   uint32_t extension_count = 0;
-  const char **extensions = glfwGetRequiredInstanceExtensions(&extension_count);
+  const char **extensions = nullptr;
+  if (!headless) {
+    extensions = glfwGetRequiredInstanceExtensions(&extension_count);
+  }
   info.enabledExtensionCount = extension_count;
   info.ppEnabledExtensionNames = extensions;
   info.enabledLayerCount = 0;
   return info;
 }
 
-VkInstance initVulkan() {
-  VkApplicationInfo application_info = getApplicationInfo();
-  VkInstanceCreateInfo create_info = getInstanceCreateInfo(&application_info);
+VkInstance initVulkan(bool headless, uint32_t api_version) {
+  VkApplicationInfo application_info = getApplicationInfo(api_version);
+  VkInstanceCreateInfo create_info =
+      getInstanceCreateInfo(&application_info, headless);
   VkInstance instance;
   if (vkCreateInstance(&create_info, nullptr, &instance) != VK_SUCCESS) {
     throw std::runtime_error("failed to create instance!");
@@ -69,6 +103,15 @@ VkSurfaceKHR createSurface(const VkInstance &instance, GLFWwindow *window) {
 namespace {
 const std::vector<const char *> kDeviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+const std::vector<const char *> kHeadlessDeviceExtensions = {};
+
+// Without a surface there is nothing to present to, so the device only needs
+// the extensions required for offscreen rendering.
+const std::vector<const char *> &
+getDeviceExtensions(const VkSurfaceKHR &surface) {
+  return surface == VK_NULL_HANDLE ? kHeadlessDeviceExtensions
+                                   : kDeviceExtensions;
+}
 
 struct SwapchainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
@@ -76,6 +119,19 @@ struct SwapchainSupportDetails {
   std::vector<VkPresentModeKHR> modes;
 };
 
+// Index of the first family supporting all of wanted and none of unwanted.
+std::optional<uint32_t>
+findQueueFamily(const std::vector<VkQueueFamilyProperties> &queue_families,
+                VkQueueFlags wanted, VkQueueFlags unwanted) {
+  for (uint32_t i = 0; i < queue_families.size(); ++i) {
+    const VkQueueFlags flags = queue_families[i].queueFlags;
+    if ((flags & wanted) == wanted && !(flags & unwanted)) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
 QueueFamilyIndices findQueueFamilyIndices(const VkPhysicalDevice &device,
                                           const VkSurfaceKHR &surface) {
   uint32_t count = 0;
@@ -91,20 +147,35 @@ QueueFamilyIndices findQueueFamilyIndices(const VkPhysicalDevice &device,
       continue;
     }
     indices.graphics_family = i;
+    if (surface == VK_NULL_HANDLE) {
+      break;
+    }
 
     VkBool32 present_support = false;
     vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &present_support);
     if (present_support) {
       indices.present_family = i;
-      return indices;
+      break;
     }
   }
+
+  // A transfer-only family usually maps to a copy engine; failing that, take
+  // the async compute family, which can copy too.
+  indices.transfer_family =
+      findQueueFamily(queue_families, VK_QUEUE_TRANSFER_BIT,
+                      VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+  if (!indices.transfer_family.has_value()) {
+    indices.transfer_family = findQueueFamily(
+        queue_families, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+  }
   return indices;
 }
 
-bool checkDeviceExtensionSupport(const VkPhysicalDevice &device) {
-  std::set<std::string> required_extensions(kDeviceExtensions.begin(),
-                                            kDeviceExtensions.end());
+bool checkDeviceExtensionSupport(
+    const VkPhysicalDevice &device,
+    const std::vector<const char *> &extensions) {
+  std::set<std::string> required_extensions(extensions.begin(),
+                                            extensions.end());
   uint32_t extension_count;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
                                        nullptr);
@@ -142,20 +213,47 @@ SwapchainSupportDetails querySwapchainSupport(const VkPhysicalDevice &device,
 
 bool isDeviceSuitable(const VkPhysicalDevice &device,
                       const VkSurfaceKHR &surface) {
+  const bool headless = surface == VK_NULL_HANDLE;
   const QueueFamilyIndices indices = findQueueFamilyIndices(device, surface);
-  if (!indices.isComplete()) {
+  if (!indices.isComplete(headless)) {
     return false;
   }
-  if (!checkDeviceExtensionSupport(device)) {
+  if (!checkDeviceExtensionSupport(device, getDeviceExtensions(surface))) {
     return false;
   }
+  if (headless) {
+    return true;
+  }
   const SwapchainSupportDetails details =
       querySwapchainSupport(device, surface);
   return !details.formats.empty() && !details.modes.empty();
 }
 
+// Vulkan 1.2 features are only usable if both the device and the instance
+// are at least 1.2.
+bool supportsDescriptorIndexing(const VkPhysicalDevice &device,
+                                const VkPhysicalDeviceProperties &properties,
+                                uint32_t instance_version) {
+  if (std::min(properties.apiVersion, instance_version) < VK_API_VERSION_1_2) {
+    return false;
+  }
+  VkPhysicalDeviceVulkan12Features features12{};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &features12;
+  vkGetPhysicalDeviceFeatures2(device, &features);
+  return features12.descriptorIndexing &&
+         features12.shaderSampledImageArrayNonUniformIndexing &&
+         features12.descriptorBindingSampledImageUpdateAfterBind &&
+         features12.descriptorBindingUpdateUnusedWhilePending &&
+         features12.descriptorBindingPartiallyBound &&
+         features12.runtimeDescriptorArray;
+}
+
 PhysicalDevice pickPhysicalDevice(const VkInstance &instance,
-                                  const VkSurfaceKHR &surface) {
+                                  const VkSurfaceKHR &surface,
+                                  uint32_t instance_version) {
   uint32_t device_count = 0;
   vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
   if (device_count == 0) {
@@ -168,10 +266,23 @@ PhysicalDevice pickPhysicalDevice(const VkInstance &instance,
     if (!isDeviceSuitable(device, surface)) {
       continue;
     }
-    return {
+    PhysicalDevice physical{
         .device = device,
         .indices = findQueueFamilyIndices(device, surface),
     };
+    vkGetPhysicalDeviceProperties(device, &physical.properties);
+    physical.descriptor_indexing =
+        supportsDescriptorIndexing(device, physical.properties,
+                                   instance_version);
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_families(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count,
+                                             queue_families.data());
+    physical.timestamp_valid_bits =
+        queue_families[physical.indices.graphics_family.value()]
+            .timestampValidBits;
+    return physical;
   }
   throw std::runtime_error("failed to find a suitable GPU!");
 }
@@ -191,34 +302,57 @@ getQueueCreateInfos(const std::set<uint32_t> &unique_queue_families,
   return infos;
 }
 
-LogicalDevice createLogicalDevice(const PhysicalDevice &physical) {
+LogicalDevice createLogicalDevice(const PhysicalDevice &physical,
+                                  const VkSurfaceKHR &surface,
+                                  bool bindless) {
   const uint32_t graphics_family = physical.indices.graphics_family.value();
-  const uint32_t present_family = physical.indices.present_family.value();
-  const std::set<uint32_t> unique_queue_families = {graphics_family,
-                                                    present_family};
+  std::set<uint32_t> unique_queue_families = {
+      graphics_family, physical.indices.transferFamily()};
+  if (physical.indices.present_family.has_value()) {
+    unique_queue_families.insert(physical.indices.present_family.value());
+  }
   float queue_priority = 1.0f;
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos =
       getQueueCreateInfos(unique_queue_families, &queue_priority);
   VkPhysicalDeviceFeatures device_features{};
+  VkPhysicalDeviceVulkan12Features features12{};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  features12.descriptorIndexing = bindless;
+  features12.shaderSampledImageArrayNonUniformIndexing = bindless;
+  features12.descriptorBindingSampledImageUpdateAfterBind = bindless;
+  features12.descriptorBindingUpdateUnusedWhilePending = bindless;
+  features12.descriptorBindingPartiallyBound = bindless;
+  features12.runtimeDescriptorArray = bindless;
 
   VkDeviceCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  info.pNext = bindless ? &features12 : nullptr;
   info.pQueueCreateInfos = queue_create_infos.data();
   info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
   info.pEnabledFeatures = &device_features;
-  info.enabledExtensionCount = static_cast<uint32_t>(kDeviceExtensions.size());
-  info.ppEnabledExtensionNames = kDeviceExtensions.data();
+  const auto &extensions = getDeviceExtensions(surface);
+  info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  info.ppEnabledExtensionNames = extensions.data();
   info.enabledLayerCount = 0;
 
   VkDevice device;
   if (vkCreateDevice(physical.device, &info, nullptr, &device) != VK_SUCCESS) {
     throw std::runtime_error("failed to create logical device!");
   }
-  VkQueue graphics, present;
+  VkQueue graphics, present = VK_NULL_HANDLE, transfer;
   vkGetDeviceQueue(device, graphics_family, 0, &graphics);
-  vkGetDeviceQueue(device, present_family, 0, &present);
+  if (physical.indices.present_family.has_value()) {
+    vkGetDeviceQueue(device, physical.indices.present_family.value(), 0,
+                     &present);
+  }
+  vkGetDeviceQueue(device, physical.indices.transferFamily(), 0, &transfer);
 
-  return {.device = device, .graphics = graphics, .present = present};
+  return {
+      .device = device,
+      .graphics = graphics,
+      .present = present,
+      .transfer = transfer,
+  };
 }
 } // namespace
 
@@ -244,11 +378,15 @@ chooseSwapPresentMode(const std::vector<VkPresentModeKHR> &modes) {
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
+VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities,
+                            GLFWwindow *window) {
   if (capabilities.currentExtent.width != UINT32_MAX) {
     return capabilities.currentExtent;
   }
-  VkExtent2D actual = {kWidth, kHeight};
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  VkExtent2D actual = {static_cast<uint32_t>(width),
+                       static_cast<uint32_t>(height)};
   actual.width = std::clamp(actual.width, capabilities.minImageExtent.width,
                             capabilities.maxImageExtent.width);
   actual.height = std::clamp(actual.height, capabilities.minImageExtent.height,
@@ -256,63 +394,54 @@ VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
   return actual;
 }
 
-std::vector<VkImageView> createImageViews(const std::vector<VkImage> &images,
-                                          const VkFormat &format,
-                                          const VkDevice &device) {
-  const int num_images = images.size();
-  std::vector<VkImageView> views(num_images);
-  for (int i = 0; i < num_images; ++i) {
-    VkImageViewCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    info.image = images[i];
-    info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    info.format = format;
-    info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    info.subresourceRange.baseMipLevel = 0;
-    info.subresourceRange.levelCount = 1;
-    info.subresourceRange.baseArrayLayer = 0;
-    info.subresourceRange.layerCount = 1;
-
-    if (vkCreateImageView(device, &info, nullptr, &views[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create image views!");
+VkFormat chooseDepthFormat(const VkPhysicalDevice &physical_device) {
+  for (const VkFormat format :
+       {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM}) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, format, &properties);
+    if (properties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+      return format;
     }
   }
-  return views;
+  throw std::runtime_error("failed to find a supported depth format!");
 }
 
-std::vector<VkFramebuffer>
-createFramebuffers(const std::vector<VkImageView> &views,
-                   const VkExtent2D &extent, const VkDevice &device) {
-  std::vector<VkFramebuffer> buffers(views.size());
-  for (size_t i = 0; i < views.size(); ++i) {
-    VkImageView attachments[] = {views[i]};
-    VkFramebufferCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    info.attachmentCount = 1;
-    info.pAttachments = attachments;
-    info.width = extent.width;
-    info.height = extent.height;
-    info.layers = 1;
-
-    if (vkCreateFramebuffer(device, &info, nullptr, &buffers[i]) !=
-        VK_SUCCESS) {
-      throw std::runtime_error("failed to create framebuffer!");
+// The largest sample count up to requested that color and depth attachments
+// both support.
+VkSampleCountFlagBits chooseSampleCount(const VkPhysicalDeviceLimits &limits,
+                                        uint32_t requested) {
+  const VkSampleCountFlags supported =
+      limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+  for (uint32_t count = VK_SAMPLE_COUNT_64_BIT; count > 1; count /= 2) {
+    if (count <= requested && (supported & count) != 0) {
+      return static_cast<VkSampleCountFlagBits>(count);
     }
   }
-  return buffers;
+  return VK_SAMPLE_COUNT_1_BIT;
+}
+
+std::vector<VkImageView> createImageViews(const std::vector<VkImage> &images,
+                                          const VkFormat &format,
+                                          const VkDevice &device) {
+  std::vector<VkImageView> views;
+  for (const auto &image : images) {
+    views.push_back(createImageView(image, format, device));
+  }
+  return views;
 }
 
+// old_swapchain, if any, is retired by the new swapchain but must still be
+// destroyed by the caller once its images are no longer in use.
 Swapchain createSwapchain(const VkPhysicalDevice &physical_device,
-                          const VkSurfaceKHR &surface,
+                          const VkSurfaceKHR &surface, GLFWwindow *window,
                           const QueueFamilyIndices &indices,
+                          const VkSwapchainKHR &old_swapchain,
                           const VkDevice &device) {
   const auto details = querySwapchainSupport(physical_device, surface);
   const auto surface_format = chooseSwapSurfaceFormat(details.formats);
-  const auto extent = chooseSwapExtent(details.capabilities);
+  const auto extent = chooseSwapExtent(details.capabilities, window);
 
   uint32_t image_count = details.capabilities.minImageCount + 1;
   const uint32_t max_count = details.capabilities.maxImageCount;
@@ -346,7 +475,7 @@ Swapchain createSwapchain(const VkPhysicalDevice &physical_device,
   info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   info.presentMode = chooseSwapPresentMode(details.modes);
   info.clipped = VK_TRUE;
-  info.oldSwapchain = VK_NULL_HANDLE;
+  info.oldSwapchain = old_swapchain;
 
   VkSwapchainKHR swapchain;
   if (vkCreateSwapchainKHR(device, &info, nullptr, &swapchain) != VK_SUCCESS) {
@@ -357,7 +486,6 @@ Swapchain createSwapchain(const VkPhysicalDevice &physical_device,
   std::vector<VkImage> images(image_count);
   vkGetSwapchainImagesKHR(device, swapchain, &image_count, images.data());
   auto views = createImageViews(images, surface_format.format, device);
-  auto buffers = createFramebuffers(views, extent, device);
 
   return {
       .chain = swapchain,
@@ -365,294 +493,208 @@ Swapchain createSwapchain(const VkPhysicalDevice &physical_device,
       .extent = extent,
       .images = std::move(images),
       .views = std::move(views),
-      .buffers = std::move(buffers),
+  };
+}
+
+Swapchain createOffscreenTargets(const VkExtent2D &extent,
+                                 uint32_t image_count,
+                                 DeviceAllocator &allocator) {
+  const VkDevice &device = allocator.device();
+  const VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+
+  std::vector<VkImage> images(image_count);
+  std::vector<Allocation> allocations(image_count);
+  for (uint32_t i = 0; i < image_count; ++i) {
+    VkImageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = format;
+    info.extent = {extent.width, extent.height, 1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = VK_SAMPLE_COUNT_1_BIT;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage =
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device, &info, nullptr, &images[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create offscreen image!");
+    }
+    allocations[i] = allocator.allocateForImage(
+        images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  }
+  auto views = createImageViews(images, format, device);
+
+  return {
+      .chain = VK_NULL_HANDLE,
+      .format = format,
+      .extent = extent,
+      .images = std::move(images),
+      .allocations = std::move(allocations),
+      .views = std::move(views),
   };
 }
 } // namespace
 
 namespace {
-VkAttachmentDescription getAttachmentDescription(const VkFormat &format) {
-  VkAttachmentDescription description{};
-  description.format = format;
-  description.samples = VK_SAMPLE_COUNT_1_BIT;
-  description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-  return description;
-}
-
-VkAttachmentReference getAttachmentReference() {
-  VkAttachmentReference reference{};
-  reference.attachment = 0;
-  reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  return reference;
-}
-
-VkSubpassDescription getSubpassDescription(VkAttachmentReference *reference) {
-  VkSubpassDescription description{};
-  description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  description.colorAttachmentCount = 1;
-  description.pColorAttachments = reference;
-  return description;
-}
-
-VkSubpassDependency getSubpassDependency() {
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  return dependency;
-}
-
-VkRenderPass createRenderPass(const VkFormat &format, const VkDevice &device) {
-  VkRenderPassCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-
-  VkAttachmentDescription attachment = getAttachmentDescription(format);
-  info.attachmentCount = 1;
-  info.pAttachments = &attachment;
-
-  VkAttachmentReference reference = getAttachmentReference();
-  VkSubpassDescription subpass = getSubpassDescription(&reference);
-  info.subpassCount = 1;
-  info.pSubpasses = &subpass;
-
-  VkSubpassDependency dependency = getSubpassDependency();
-  info.dependencyCount = 1;
-  info.pDependencies = &dependency;
-
-  VkRenderPass pass;
-  if (vkCreateRenderPass(device, &info, nullptr, &pass) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create render pass!");
-  }
-  return pass;
-}
-
-VkPipelineLayout createPipelineLayout(const VkDevice &device) {
-  VkPipelineLayoutCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  info.setLayoutCount = 0;
-  info.pSetLayouts = nullptr;
-  info.pushConstantRangeCount = 0;
-  info.pPushConstantRanges = nullptr;
-  VkPipelineLayout layout;
-  if (vkCreatePipelineLayout(device, &info, nullptr, &layout) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create pipeline layout!");
-  }
+struct Vertex {
+  float position[2];
+  float color[3];
+};
+
+// Per-vertex data binds to 0 and InstanceData to kInstanceBinding.
+constexpr uint32_t kInstanceBinding = 1;
+
+VertexLayout getVertexLayout() {
+  VertexLayout layout;
+  layout.addBinding({VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT});
+  layout.addBinding(getInstanceFormats(), VK_VERTEX_INPUT_RATE_INSTANCE);
   return layout;
 }
 
-std::vector<VkPipelineShaderStageCreateInfo>
-getPipelineShaderStageCreateInfos(const VkShaderModule &vertex,
-                                  const VkShaderModule &fragment) {
-  std::vector<VkPipelineShaderStageCreateInfo> infos;
-  {
-    VkPipelineShaderStageCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    info.module = vertex;
-    info.pName = "main";
-    infos.emplace_back(info);
-  }
-  {
-    VkPipelineShaderStageCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    info.module = fragment;
-    info.pName = "main";
-    infos.emplace_back(info);
+std::vector<MeshData> createDefaultMeshes() {
+  const std::vector<Vertex> vertices = {
+      {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+      {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+      {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+  };
+  MeshData triangle;
+  triangle.streams = {toBytes(vertices)};
+  triangle.vertex_count = static_cast<uint32_t>(vertices.size());
+  triangle.indices = {0, 1, 2};
+  for (const auto &vertex : vertices) {
+    triangle.bounds.radius =
+        std::max(triangle.bounds.radius,
+                 std::hypot(vertex.position[0], vertex.position[1]));
   }
-  return infos;
+  return {triangle};
 }
 
-VkPipelineVertexInputStateCreateInfo getPipelineVertexInputStateCreateInfo() {
-  VkPipelineVertexInputStateCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  info.vertexBindingDescriptionCount = 0;
-  info.pVertexBindingDescriptions = nullptr;
-  info.vertexAttributeDescriptionCount = 0;
-  info.pVertexAttributeDescriptions = nullptr;
-  return info;
+// The key drawing mesh of file with the vertex formats stored in the file.
+// The shaders take a position and a color in one stream.
+PipelineKey getMeshFileKey(const MeshFile &file, uint32_t mesh,
+                           const PipelineKey &base) {
+  const MeshFileRecord &record = file.record(mesh);
+  const MeshFileStream &stream = record.streams[0];
+  if (record.stream_count != 1 || stream.attribute_count != 2 ||
+      stream.attributes[0].semantic != VertexSemantic::kPosition ||
+      stream.attributes[1].semantic != VertexSemantic::kColor) {
+    throw std::runtime_error("mesh file layout does not match the shader "
+                             "inputs!");
+  }
+  VertexLayout layout = file.vertexLayout(mesh);
+  layout.addBinding(getInstanceFormats(), VK_VERTEX_INPUT_RATE_INSTANCE);
+  PipelineKey key = base;
+  key.setVertexLayout(layout);
+  return key;
 }
 
-VkPipelineInputAssemblyStateCreateInfo
-getPipelineInputAssemblyStateCreateInfo() {
-  VkPipelineInputAssemblyStateCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  info.primitiveRestartEnable = VK_FALSE;
-  return info;
+// The depth-only variant of key for the depth prepass.
+PipelineKey getDepthPrepassKey(const PipelineKey &key,
+                               const VkRenderPass &render_pass) {
+  PipelineKey depth_key = key;
+  depth_key.fragment_shader.clear();
+  depth_key.depth_test = true;
+  depth_key.depth_write = true;
+  depth_key.render_pass = render_pass;
+  return depth_key;
 }
 
-VkViewport getViewport(const VkExtent2D &extent) {
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)extent.width;
-  viewport.height = (float)extent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  return viewport;
-}
-
-VkRect2D getScissor(const VkExtent2D &extent) {
-  VkRect2D scissor{};
-  scissor.offset = {0, 0};
-  scissor.extent = extent;
-  return scissor;
-}
-
-VkPipelineViewportStateCreateInfo getViewportState(VkViewport *viewport,
-                                                   VkRect2D *scissor) {
-  VkPipelineViewportStateCreateInfo state{};
-  state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  state.viewportCount = 1;
-  state.pViewports = viewport;
-  state.scissorCount = 1;
-  state.pScissors = scissor;
-  return state;
-}
-
-VkPipelineRasterizationStateCreateInfo getRasterizer() {
-  VkPipelineRasterizationStateCreateInfo rasterizer{};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-  rasterizer.depthBiasConstantFactor = 0.0f;
-  rasterizer.depthBiasClamp = 0.0f;
-  rasterizer.depthBiasSlopeFactor = 0.0f;
-  return rasterizer;
-}
-
-VkPipelineMultisampleStateCreateInfo getMultisampling() {
-  VkPipelineMultisampleStateCreateInfo multisampling{};
-  multisampling.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f;
-  multisampling.pSampleMask = nullptr;
-  multisampling.alphaToCoverageEnable = VK_FALSE;
-  multisampling.alphaToOneEnable = VK_FALSE;
-  return multisampling;
-}
-
-VkPipelineColorBlendAttachmentState getColorBlendAttachment() {
-  VkPipelineColorBlendAttachmentState blend{};
-  blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  blend.blendEnable = VK_FALSE;
-  blend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-  blend.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-  blend.colorBlendOp = VK_BLEND_OP_ADD;
-  blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-  blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-  blend.alphaBlendOp = VK_BLEND_OP_ADD;
-  return blend;
-}
-
-VkPipelineColorBlendStateCreateInfo
-getColorBlend(VkPipelineColorBlendAttachmentState *attachment) {
-  VkPipelineColorBlendStateCreateInfo color_blending{};
-  color_blending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  color_blending.logicOpEnable = VK_FALSE;
-  color_blending.logicOp = VK_LOGIC_OP_COPY;
-  color_blending.attachmentCount = 1;
-  color_blending.pAttachments = attachment;
-  color_blending.blendConstants[0] = 0.0f;
-  color_blending.blendConstants[1] = 0.0f;
-  color_blending.blendConstants[2] = 0.0f;
-  color_blending.blendConstants[3] = 0.0f;
-  return color_blending;
-}
-
-std::vector<VkDynamicState> getDynamicStates() {
-  return {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_LINE_WIDTH};
-}
-
-VkPipelineDynamicStateCreateInfo
-getDynamicStateCreateInfo(std::vector<VkDynamicState> &states) {
-  VkPipelineDynamicStateCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  info.dynamicStateCount = states.size();
-  info.pDynamicStates = states.data();
-  return info;
+// Appends count instances laid out on a square grid covering the viewport.
+// A single instance is drawn untransformed and untinted. Instance i uses
+// materials[i % materials.size()], or the default material if there are
+// none. Earlier instances are in front, so the grid is added front to back.
+void addInstanceGrid(uint32_t count, const std::vector<uint32_t> &materials,
+                     std::vector<InstanceData> &instances) {
+  const uint32_t side =
+      static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  const float cell = 2.0f / side;
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t x = i % side;
+    const uint32_t y = i / side;
+    const uint32_t red = 255 - 128 * x / side;
+    const uint32_t green = 255 - 128 * y / side;
+    instances.push_back({
+        .transform = {cell / 2, 0.0f, 0.0f, cell / 2},
+        .translation = {-1.0f + cell * (x + 0.5f), -1.0f + cell * (y + 0.5f)},
+        .tint = red | green << 8 | 0xffu << 16 | 0xffu << 24,
+        .material = materials.empty() ? 0 : materials[i % materials.size()],
+        .depth = (i + 1.0f) / (count + 1),
+    });
+  }
 }
 
-VkPipeline createGraphicsPipeline(const VkDevice &device,
-                                  const VkExtent2D &extent,
-                                  const VkPipelineLayout &layout,
-                                  const VkRenderPass &pass) {
-  VkGraphicsPipelineCreateInfo info{};
-  info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-
-  const VkShaderModule vert_shader = createShaderModule("shader.vert", device);
-  const VkShaderModule frag_shader = createShaderModule("shader.frag", device);
-  auto shader_stages =
-      getPipelineShaderStageCreateInfos(vert_shader, frag_shader);
-  info.stageCount = 2;
-  info.pStages = shader_stages.data();
-
-  auto vertex_input_info = getPipelineVertexInputStateCreateInfo();
-  info.pVertexInputState = &vertex_input_info;
-
-  auto input_assembly = getPipelineInputAssemblyStateCreateInfo();
-  info.pInputAssemblyState = &input_assembly;
-
-  auto viewport = getViewport(extent);
-  auto scissor = getScissor(extent);
-  auto viewport_state = getViewportState(&viewport, &scissor);
-  info.pViewportState = &viewport_state;
-
-  auto rasterizer = getRasterizer();
-  info.pRasterizationState = &rasterizer;
-
-  auto multisampling = getMultisampling();
-  info.pMultisampleState = &multisampling;
-
-  info.pDepthStencilState = nullptr;
+// The world-space bounding sphere of instance of a mesh bounded by bounds.
+// As in cull.comp, the Frobenius norm bounds how far the transform
+// stretches the circle.
+void addInstanceBounds(const InstanceData &instance, const Bounds &bounds,
+                       BoundsArray &bounds_array) {
+  const float *transform = instance.transform;
+  bounds_array.add(
+      transform[0] * bounds.center[0] + transform[2] * bounds.center[1] +
+          instance.translation[0],
+      transform[1] * bounds.center[0] + transform[3] * bounds.center[1] +
+          instance.translation[1],
+      instance.depth,
+      bounds.radius * std::sqrt(transform[0] * transform[0] +
+                                transform[1] * transform[1] +
+                                transform[2] * transform[2] +
+                                transform[3] * transform[3]));
+}
 
-  auto color_blend_attachment = getColorBlendAttachment();
-  auto color_blending = getColorBlend(&color_blend_attachment);
-  info.pColorBlendState = &color_blending;
+// Pixels across one cell of addInstanceGrid() at the given zoom.
+float getInstanceScreenSize(uint32_t count, float zoom,
+                            const VkExtent2D &extent) {
+  const uint32_t side =
+      static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+  const float cell = 2.0f / side;
+  return cell / 2 * zoom * std::max(extent.width, extent.height) / 2;
+}
+} // namespace
 
-  info.pDynamicState = nullptr;
-  info.layout = layout;
-  info.renderPass = pass;
-  info.subpass = 0;
-  info.basePipelineHandle = VK_NULL_HANDLE;
-  info.basePipelineIndex = -1;
+namespace {
+// Space for the FrameUniforms of every frame in flight, many times over.
+constexpr VkDeviceSize kUniformRingSize = 64 * 1024;
+
+std::vector<VkDescriptorSetLayoutBinding> getFrameSetBindings() {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  return {binding};
+}
 
-  VkPipeline pipeline;
-  if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, nullptr,
-                                &pipeline) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create graphics pipeline!");
+VkPipelineLayout
+createPipelineLayout(const std::vector<VkDescriptorSetLayout> &set_layouts,
+                     const VkDevice &device) {
+  VkPushConstantRange range{};
+  range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  range.offset = 0;
+  range.size = sizeof(DrawConstants);
+  VkPipelineLayoutCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+  info.pSetLayouts = set_layouts.data();
+  info.pushConstantRangeCount = 1;
+  info.pPushConstantRanges = &range;
+  VkPipelineLayout layout;
+  if (vkCreatePipelineLayout(device, &info, nullptr, &layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline layout!");
   }
-  vkDestroyShaderModule(device, frag_shader, nullptr);
-  vkDestroyShaderModule(device, vert_shader, nullptr);
-  return pipeline;
+  return layout;
 }
 } // namespace
 
 namespace {
-VkCommandPool createCommandPool(const QueueFamilyIndices &indices,
+VkCommandPool createCommandPool(uint32_t queue_family,
+                                VkCommandPoolCreateFlags flags,
                                 const VkDevice &device) {
   VkCommandPoolCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  info.queueFamilyIndex = indices.graphics_family.value();
+  info.flags = flags;
+  info.queueFamilyIndex = queue_family;
   VkCommandPool pool;
   if (vkCreateCommandPool(device, &info, nullptr, &pool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create command pool!");
@@ -660,12 +702,13 @@ VkCommandPool createCommandPool(const QueueFamilyIndices &indices,
   return pool;
 }
 
-VkCommandBuffer createCommandBuffer(const VkCommandPool &pool,
-                                    const VkDevice &device) {
+VkCommandBuffer createCommandBuffer(
+    const VkCommandPool &pool, const VkDevice &device,
+    VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
   VkCommandBufferAllocateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   info.commandPool = pool;
-  info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  info.level = level;
   info.commandBufferCount = 1;
   VkCommandBuffer buffer;
   if (vkAllocateCommandBuffers(device, &info, &buffer) != VK_SUCCESS) {
@@ -694,43 +737,269 @@ VkFence createFence(const VkDevice &device) {
   }
   return fence;
 }
-} // namespace
 
-ComputerGraphicsApplication::ComputerGraphicsApplication() {
-  window_ = initWindow();
-  instance_ = initVulkan();
-  surface_ = createSurface(instance_, window_);
+std::vector<Frame> createFrames(uint32_t count, uint32_t worker_count,
+                                uint32_t queue_family,
+                                const VkDevice &device) {
+  std::vector<Frame> frames(count);
+  for (auto &frame : frames) {
+    frame.command_pool = createCommandPool(
+        queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, device);
+    frame.command_buffer = createCommandBuffer(frame.command_pool, device);
+    for (uint32_t i = 0; i < worker_count; ++i) {
+      frame.worker_pools.push_back(createCommandPool(
+          queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, device));
+      frame.worker_buffers.push_back(
+          createCommandBuffer(frame.worker_pools.back(), device,
+                              VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+    }
+    frame.image_available = createSemaphore(device);
+    frame.render_finished = createSemaphore(device);
+    frame.in_flight = createFence(device);
+  }
+  return frames;
+}
+} // namespace
 
-  physical_ = pickPhysicalDevice(instance_, surface_);
-  logical_ = createLogicalDevice(physical_);
-  swapchain_ = createSwapchain(physical_.device, surface_, physical_.indices,
-                               logical_.device);
+ComputerGraphicsApplication::ComputerGraphicsApplication(
+    const ApplicationOptions &options)
+    : options_(options) {
+  if (options_.frames_in_flight < 1 ||
+      options_.frames_in_flight > kMaxFramesInFlight) {
+    throw std::runtime_error("frames in flight must be between 1 and " +
+                             std::to_string(kMaxFramesInFlight) + "!");
+  }
+  if (options_.width == 0 || options_.height == 0) {
+    throw std::runtime_error("render target size must be non-zero!");
+  }
+  if (!options_.headless) {
+    window_ = initWindow(options_.width, options_.height);
+    glfwSetWindowUserPointer(window_, this);
+    glfwSetFramebufferSizeCallback(window_, [](GLFWwindow *window, int, int) {
+      static_cast<ComputerGraphicsApplication *>(
+          glfwGetWindowUserPointer(window))
+          ->framebuffer_resized_ = true;
+    });
+  }
+  const uint32_t api_version = getInstanceApiVersion();
+  instance_ = initVulkan(options_.headless, api_version);
+  if (!options_.headless) {
+    surface_ = createSurface(instance_, window_);
+  }
 
-  render_pass_ = createRenderPass(swapchain_.format, logical_.device);
-  pipeline_layout_ = createPipelineLayout(logical_.device);
-  graphics_pipeline_ = createGraphicsPipeline(
-      logical_.device, swapchain_.extent, pipeline_layout_, render_pass_);
-  command_pool_ = createCommandPool(physical_.indices, logical_.device);
-  command_buffer_ = createCommandBuffer(command_pool_, logical_.device);
+  physical_ = pickPhysicalDevice(instance_, surface_, api_version);
+  if (!options_.textures.empty() && !options_.bindless) {
+    throw std::runtime_error("streamed textures require bindless "
+                             "rendering!");
+  }
+  if (options_.bindless && !physical_.descriptor_indexing) {
+    throw std::runtime_error("bindless rendering requires descriptor "
+                             "indexing!");
+  }
+  logical_ = createLogicalDevice(physical_, surface_, options_.bindless);
+  allocator_ =
+      std::make_unique<DeviceAllocator>(physical_.device, logical_.device);
+  if (options_.bindless) {
+    bindless_ = std::make_unique<BindlessTable>(*allocator_,
+                                                options_.frames_in_flight);
+  }
+  if (options_.headless) {
+    // One offscreen image per frame slot, so a slot's fence also guards its
+    // image.
+    swapchain_ = createOffscreenTargets({options_.width, options_.height},
+                                        options_.frames_in_flight,
+                                        *allocator_);
+  } else {
+    swapchain_ = createSwapchain(physical_.device, surface_, window_,
+                                 physical_.indices, VK_NULL_HANDLE,
+                                 logical_.device);
+  }
 
-  image_available_semaphore_ = createSemaphore(logical_.device);
-  render_finished_semaphore_ = createSemaphore(logical_.device);
-  in_flight_fence_ = createFence(logical_.device);
+  pipeline_cache_ = std::make_unique<PipelineCache>(
+      logical_.device, physical_.properties, options_.pipeline_cache_path);
+  set_layouts_ = std::make_unique<DescriptorSetLayoutCache>(logical_.device);
+  frame_set_layout_ = set_layouts_->get(getFrameSetBindings());
+  std::vector<VkDescriptorSetLayout> set_layouts = {frame_set_layout_};
+  if (bindless_) {
+    set_layouts.push_back(bindless_->setLayout());
+    pipeline_key_.fragment_shader = "bindless.frag";
+  }
+  pipeline_layout_ = createPipelineLayout(set_layouts, logical_.device);
+  pipelines_ = std::make_unique<PipelineLibrary>(
+      logical_.device, pipeline_cache_->handle(),
+      options_.pipeline_compile_threads);
+  command_pool_ = createCommandPool(physical_.indices.graphics_family.value(),
+                                    VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                                    logical_.device);
+  transfer_pool_ = createCommandPool(physical_.indices.transferFamily(),
+                                     VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                                     logical_.device);
+  if (bindless_) {
+    const uint32_t white = 0xffffffffu;
+    samplers_ = std::make_unique<SamplerCache>(logical_.device);
+    default_texture_ = createTexture(
+        *allocator_, 1, 1, &white,
+        {logical_.graphics, physical_.indices.graphics_family.value(),
+         command_pool_});
+    bindless_->addTexture(default_texture_.view, samplers_->get());
+    bindless_->addMaterial(*allocator_, Material{});
+  }
+  // Residency changes are recorded into each frame's command buffer.
+  if (!options_.textures.empty() && !options_.static_scene) {
+    streamer_ = std::make_unique<TextureStreamer>(
+        *allocator_, *bindless_, samplers_->get(), options_.frames_in_flight,
+        VkDeviceSize{options_.texture_budget_mb} << 20);
+    for (const auto &path : options_.textures) {
+      texture_materials_.push_back(streamer_->material(streamer_->add(path)));
+    }
+  }
+  if (options_.gpu_culling && !options_.static_scene) {
+    culler_ = std::make_unique<GpuCuller>(
+        logical_.device, pipeline_cache_->handle(), options_.frames_in_flight);
+  }
+  jobs_ = std::make_unique<JobSystem>(
+      options_.job_threads.value_or(
+          std::max(std::thread::hardware_concurrency(), 1u) - 1),
+      options_.frames_in_flight);
+  // The passes depend on the features created above; the main pass's render
+  // pass is then known for the pipelines.
+  depth_format_ = chooseDepthFormat(physical_.device);
+  samples_ =
+      chooseSampleCount(physical_.properties.limits, options_.msaa_samples);
+  graph_ = std::make_unique<RenderGraph>(*allocator_,
+                                         options_.frames_in_flight);
+  buildFrameGraph();
+
+  pipeline_key_.setVertexLayout(getVertexLayout());
+  pipeline_key_.render_pass = graph_->renderPass(main_pass_);
+  pipeline_key_.layout = pipeline_layout_;
+  pipeline_key_.samples = samples_;
+  // With a prepass the main pass only tests against the depth laid down.
+  pipeline_key_.depth_test = true;
+  pipeline_key_.depth_write = !options_.depth_prepass;
+  // Compiled up front, as it is the fallback for every other permutation.
+  graphics_pipeline_ = pipelines_->getBlocking(pipeline_key_);
+  // Mapped only until submit() has staged its contents.
+  std::optional<MeshFile> mesh_file;
+  if (options_.mesh_file.empty()) {
+    meshes_ = uploadMeshes(createDefaultMeshes(), *allocator_, upload_batch_);
+    mesh_keys_.assign(meshes_.size(), pipeline_key_);
+  } else {
+    mesh_file.emplace(options_.mesh_file);
+    meshes_ = uploadMeshes(*mesh_file, *allocator_, upload_batch_);
+    for (uint32_t i = 0; i < mesh_file->meshCount(); ++i) {
+      mesh_keys_.push_back(getMeshFileKey(*mesh_file, i, pipeline_key_));
+    }
+  }
+  upload_batch_.submit(
+      *allocator_,
+      {logical_.transfer, physical_.indices.transferFamily(), transfer_pool_},
+      {logical_.graphics, physical_.indices.graphics_family.value(),
+       command_pool_});
+  mesh_file.reset();
+  for (const auto &key : mesh_keys_) {
+    mesh_pipelines_.push_back(pipelines_->getBlocking(key));
+    if (options_.depth_prepass) {
+      mesh_prepass_pipelines_.push_back(pipelines_->getBlocking(
+          getDepthPrepassKey(key, graph_->renderPass(prepass_))));
+    }
+  }
+  instance_stream_ = InstanceStream(options_.frames_in_flight);
+  descriptors_ = std::make_unique<DescriptorAllocator>(
+      logical_.device, options_.frames_in_flight);
+  uniforms_ = UniformRing(
+      *allocator_, kUniformRingSize, options_.frames_in_flight,
+      physical_.properties.limits.minUniformBufferOffsetAlignment);
+  if (culler_) {
+    culler_->setBounds(*allocator_, meshes_);
+  }
+  for (uint32_t mesh = 0; mesh < meshes_.size(); ++mesh) {
+    addInstanceGrid(options_.instance_count, texture_materials_,
+                    scene_instances_);
+    scene_meshes_.resize(scene_instances_.size(), mesh);
+  }
+  cpu_culling_ = options_.cpu_culling && !culler_ && !options_.static_scene;
+  if (cpu_culling_) {
+    scene_bounds_.reserve(scene_instances_.size());
+    for (size_t i = 0; i < scene_instances_.size(); ++i) {
+      addInstanceBounds(scene_instances_[i], meshes_[scene_meshes_[i]].bounds,
+                        scene_bounds_);
+    }
+  }
+  frame_pipelines_.resize(meshes_.size());
+  frames_ = createFrames(options_.frames_in_flight, options_.recording_threads,
+                         physical_.indices.graphics_family.value(),
+                         logical_.device);
+  gpu_profiler_ = std::make_unique<GpuProfiler>(
+      logical_.device, options_.frames_in_flight,
+      physical_.timestamp_valid_bits,
+      physical_.properties.limits.timestampPeriod);
+  images_in_flight_.assign(swapchain_.images.size(), VK_NULL_HANDLE);
+  if (options_.static_scene) {
+    static_command_pool_ = createCommandPool(
+        physical_.indices.graphics_family.value(), 0, logical_.device);
+    static_instances_ = InstanceStream(1);
+    static_descriptors_ =
+        std::make_unique<DescriptorAllocator>(logical_.device, 1);
+    static_uniforms_ = UniformRing(
+        *allocator_, kUniformRingSize, 1,
+        physical_.properties.limits.minUniformBufferOffsetAlignment);
+  }
 }
 
 ComputerGraphicsApplication::~ComputerGraphicsApplication() {
-  vkDestroySemaphore(logical_.device, image_available_semaphore_, nullptr);
-  vkDestroySemaphore(logical_.device, render_finished_semaphore_, nullptr);
-  vkDestroyFence(logical_.device, in_flight_fence_, nullptr);
+  vkDeviceWaitIdle(logical_.device);
+  for (auto &frame : frames_) {
+    frame.destroy(logical_.device);
+  }
+  gpu_profiler_->destroy(logical_.device);
 
+  upload_batch_.wait(*allocator_);
+  for (auto &mesh : meshes_) {
+    mesh.destroy(*allocator_);
+  }
+  instance_stream_.destroy(*allocator_);
+  if (culler_) {
+    culler_->destroy(*allocator_);
+  }
+  static_instances_.destroy(*allocator_);
+  uniforms_.destroy(*allocator_);
+  static_uniforms_.destroy(*allocator_);
+  descriptors_->destroy();
+  if (static_descriptors_) {
+    static_descriptors_->destroy();
+  }
+  if (streamer_) {
+    streamer_->destroy();
+  }
+  if (bindless_) {
+    bindless_->destroy(*allocator_);
+    default_texture_.destroy(*allocator_);
+    samplers_->destroy();
+  }
+  if (static_command_pool_ != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(logical_.device, static_command_pool_, nullptr);
+  }
+  vkDestroyCommandPool(logical_.device, transfer_pool_, nullptr);
   vkDestroyCommandPool(logical_.device, command_pool_, nullptr);
-  vkDestroyPipeline(logical_.device, graphics_pipeline_, nullptr);
+  pipelines_->destroy();
   vkDestroyPipelineLayout(logical_.device, pipeline_layout_, nullptr);
-  vkDestroyRenderPass(logical_.device, render_pass_, nullptr);
+  set_layouts_->destroy();
+  pipeline_cache_->save(logical_.device);
+  pipeline_cache_->destroy(logical_.device);
+  graph_->destroy();
 
-  swapchain_.destroy(logical_.device);
+  for (auto &retired : retired_swapchains_) {
+    retired.swapchain.destroy(*allocator_);
+  }
+  swapchain_.destroy(*allocator_);
+  allocator_.reset();
 
   vkDestroyDevice(logical_.device, nullptr);
+  if (options_.headless) {
+    vkDestroyInstance(instance_, nullptr);
+    return;
+  }
   vkDestroySurfaceKHR(instance_, surface_, nullptr);
   vkDestroyInstance(instance_, nullptr);
   glfwDestroyWindow(window_);
@@ -738,42 +1007,345 @@ ComputerGraphicsApplication::~ComputerGraphicsApplication() {
 }
 
 void ComputerGraphicsApplication::run() {
-  while (!glfwWindowShouldClose(window_)) {
-    glfwPollEvents();
+  if (options_.headless) {
+    for (uint32_t i = 0; i < options_.frame_count; ++i) {
+      drawFrame();
+    }
+  } else {
+    while (pollWindow()) {
+      drawFrame();
+    }
+  }
+  vkDeviceWaitIdle(logical_.device);
+}
+
+BenchmarkReport ComputerGraphicsApplication::benchmark(uint32_t frame_count,
+                                                       uint32_t warmup_frames) {
+  BenchmarkReport report{
+      .device_name = physical_.properties.deviceName,
+      .headless = options_.headless,
+      .frames_in_flight = options_.frames_in_flight,
+      .warmup_frames = warmup_frames,
+  };
+  for (uint32_t i = 0; i < warmup_frames && pollWindow(); ++i) {
+    drawFrame();
+  }
+  const auto start = Clock::now();
+  for (uint32_t i = 0; i < frame_count && pollWindow(); ++i) {
     drawFrame();
+    report.statistics.add(last_timings_);
   }
   vkDeviceWaitIdle(logical_.device);
+  report.wall_seconds = millisecondsSince(start) / 1000.0;
+  return report;
 }
 
-void ComputerGraphicsApplication::drawFrame() {
-  vkWaitForFences(logical_.device, 1, &in_flight_fence_, VK_TRUE, UINT64_MAX);
-  vkResetFences(logical_.device, 1, &in_flight_fence_);
+bool ComputerGraphicsApplication::pollWindow() {
+  if (options_.headless) {
+    return true;
+  }
+  glfwPollEvents();
+  // A minimized window has no surface area to render to, so sleep until it
+  // is restored.
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window_, &width, &height);
+  while ((width == 0 || height == 0) && !glfwWindowShouldClose(window_)) {
+    glfwWaitEvents();
+    glfwGetFramebufferSize(window_, &width, &height);
+  }
+  return !glfwWindowShouldClose(window_);
+}
 
-  uint32_t image_index;
-  vkAcquireNextImageKHR(logical_.device, swapchain_.chain, UINT64_MAX,
-                        image_available_semaphore_, VK_NULL_HANDLE,
-                        &image_index);
+bool ComputerGraphicsApplication::recreateSwapchain() {
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window_, &width, &height);
+  if (width == 0 || height == 0) {
+    return false;
+  }
+  framebuffer_resized_ = false;
+
+  Swapchain swapchain =
+      createSwapchain(physical_.device, surface_, window_, physical_.indices,
+                      swapchain_.chain, logical_.device);
+  // The render pass, and with it the pipeline, is tied to the format.
+  if (swapchain.format != swapchain_.format) {
+    swapchain.destroy(*allocator_);
+    throw std::runtime_error("swap chain format changed on recreation!");
+  }
 
-  vkResetCommandBuffer(command_buffer_, 0);
-  recordCommandBuffer(command_buffer_, image_index);
+  // Frames still rendering into the old images hold these fences; once each
+  // has been seen signaled, the old swapchain can go.
+  RetiredSwapchain retired{.swapchain = std::move(swapchain_)};
+  for (VkFence fence : images_in_flight_) {
+    if (fence != VK_NULL_HANDLE &&
+        std::find(retired.pending_fences.begin(), retired.pending_fences.end(),
+                  fence) == retired.pending_fences.end()) {
+      retired.pending_fences.push_back(fence);
+    }
+  }
+  retired_swapchains_.push_back(std::move(retired));
+  swapchain_ = std::move(swapchain);
+  images_in_flight_.assign(swapchain_.images.size(), VK_NULL_HANDLE);
+  buildFrameGraph();
+  markSceneDirty();
+  return true;
+}
+
+void ComputerGraphicsApplication::releaseRetiredSwapchains() {
+  for (auto it = retired_swapchains_.begin();
+       it != retired_swapchains_.end();) {
+    auto &fences = it->pending_fences;
+    fences.erase(std::remove_if(fences.begin(), fences.end(),
+                                [this](VkFence fence) {
+                                  return vkGetFenceStatus(logical_.device,
+                                                          fence) == VK_SUCCESS;
+                                }),
+                 fences.end());
+    if (!fences.empty()) {
+      ++it;
+      continue;
+    }
+    it->swapchain.destroy(*allocator_);
+    it = retired_swapchains_.erase(it);
+  }
+}
+
+void ComputerGraphicsApplication::buildFrameGraph() {
+  graph_->reset();
+  // Ready once the acquire semaphore, waited on at this stage, has signaled.
+  target_ = graph_->importImage(
+      "swapchain", {swapchain_.format, swapchain_.extent},
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      options_.headless ? ResourceUsage::kTransferSrc
+                        : ResourceUsage::kPresent);
+  if (streamer_) {
+    // Synchronizes its uploads itself.
+    const RenderGraph::Pass streaming = graph_->addPass(
+        "texture_streaming",
+        [this](VkCommandBuffer command_buffer, const PassContext &) {
+          streamer_->update(command_buffer, current_frame_);
+        });
+    graph_->setSideEffects(streaming);
+  }
+
+  std::optional<RenderGraph::Resource> visible, commands;
+  if (culler_) {
+    visible = graph_->importBuffer("visible");
+    commands = graph_->importBuffer("commands");
+    const RenderGraph::Pass cull = graph_->addPass(
+        "cull", [this](VkCommandBuffer command_buffer, const PassContext &) {
+          culler_->cull(command_buffer, *allocator_, current_frame_,
+                        batcher_, meshes_,
+                        instance_stream_.buffer(current_frame_),
+                        frameUniforms());
+        });
+    graph_->use(cull, *visible, ResourceUsage::kStorageWrite);
+    graph_->use(cull, *commands, ResourceUsage::kStorageWrite);
+  }
+
+  const RenderGraph::Resource depth = graph_->createImage(
+      "depth", {depth_format_, swapchain_.extent, samples_});
+  if (options_.depth_prepass) {
+    prepass_ = graph_->addPass(
+        "depth_prepass",
+        [this](VkCommandBuffer command_buffer, const PassContext &context) {
+          recordDepthPrepass(command_buffer, context);
+        });
+    graph_->setDepthAttachment(prepass_, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    if (culler_) {
+      graph_->use(prepass_, *visible, ResourceUsage::kVertexRead);
+      graph_->use(prepass_, *commands, ResourceUsage::kIndirectRead);
+    }
+  }
+
+  const bool secondaries =
+      options_.recording_threads > 0 && !options_.static_scene;
+  main_pass_ = graph_->addPass(
+      "render_pass",
+      [this](VkCommandBuffer command_buffer, const PassContext &context) {
+        recordMainPass(command_buffer, context);
+      },
+      secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                  : VK_SUBPASS_CONTENTS_INLINE);
+  const VkClearColorValue clear = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  if (samples_ != VK_SAMPLE_COUNT_1_BIT) {
+    // Resolved within the pass, so the samples are never stored.
+    const RenderGraph::Resource color = graph_->createImage(
+        "color", {swapchain_.format, swapchain_.extent, samples_});
+    graph_->addColorAttachment(main_pass_, color, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                               clear);
+    graph_->addResolveAttachment(main_pass_, target_);
+  } else {
+    graph_->addColorAttachment(main_pass_, target_,
+                               VK_ATTACHMENT_LOAD_OP_CLEAR, clear);
+  }
+  if (options_.depth_prepass) {
+    graph_->setDepthAttachment(main_pass_, depth, VK_ATTACHMENT_LOAD_OP_LOAD,
+                               {}, true);
+  } else {
+    graph_->setDepthAttachment(main_pass_, depth, VK_ATTACHMENT_LOAD_OP_CLEAR);
+  }
+  if (culler_) {
+    graph_->use(main_pass_, *visible, ResourceUsage::kVertexRead);
+    graph_->use(main_pass_, *commands, ResourceUsage::kIndirectRead);
+  }
+  graph_->compile();
+}
+
+FrameImage ComputerGraphicsApplication::readbackFrame() {
+  if (!options_.headless) {
+    throw std::runtime_error("frame readback requires headless mode!");
+  }
+  // Until a frame has been drawn the image is still undefined.
+  if (frame_number_ == 0) {
+    throw std::runtime_error("no frame has been rendered to read back!");
+  }
+  const VkDevice &device = logical_.device;
+  const VkImage image = swapchain_.images[last_image_index_];
+  const VkExtent2D extent = swapchain_.extent;
+  const VkDeviceSize size = VkDeviceSize{extent.width} * extent.height * 4;
+  Buffer readback = createBuffer(*allocator_, size,
+                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+  VkCommandBuffer command_buffer =
+      beginSingleTimeCommands(command_pool_, device);
+  // The frame graph already left the image in TRANSFER_SRC_OPTIMAL; this only
+  // makes its color writes visible to the copy.
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  VkBufferImageCopy region{};
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {extent.width, extent.height, 1};
+  vkCmdCopyImageToBuffer(command_buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         readback.buffer, 1, &region);
+  endSingleTimeCommands(command_buffer, command_pool_, logical_.graphics,
+                        device);
+
+  FrameImage frame{extent.width, extent.height,
+                   std::vector<uint8_t>(static_cast<size_t>(size))};
+  std::memcpy(frame.pixels.data(), readback.allocation.mapped,
+              frame.pixels.size());
+  readback.destroy(*allocator_);
+  return frame;
+}
+
+void ComputerGraphicsApplication::drawFrame() {
+  const auto frame_start = Clock::now();
+  FrameTimings timings;
+  Frame &frame = frames_[current_frame_];
+  vkWaitForFences(logical_.device, 1, &frame.in_flight, VK_TRUE, UINT64_MAX);
+  timings.fence_wait_ms = millisecondsSince(frame_start);
+  jobs_->beginFrame(current_frame_);
+  // Pre-recorded command buffers carry no per-slot timestamp queries.
+  if (!options_.static_scene &&
+      gpu_profiler_->collect(logical_.device, current_frame_)) {
+    timings.gpu_ms = gpu_profiler_->lastScopeMilliseconds("frame");
+  }
+  ++frame_number_;
+  if (options_.gpu_log_interval > 0 &&
+      frame_number_ % options_.gpu_log_interval == 0) {
+    gpu_profiler_->logSummary(std::clog);
+  }
+  if (options_.pipeline_cache_save_interval > 0) {
+    pipeline_cache_->saveIfDue(
+        logical_.device,
+        std::chrono::seconds(options_.pipeline_cache_save_interval));
+  }
+  upload_batch_.poll(*allocator_);
+  releaseRetiredSwapchains();
+  if (bindless_) {
+    bindless_->beginFrame(current_frame_);
+  }
+  if (!options_.static_scene) {
+    updateInstances();
+  } else if (commands_dirty_ ||
+             pipelines_->generation() != recorded_pipeline_generation_) {
+    recordStaticCommandBuffers();
+  }
+
+  uint32_t image_index = current_frame_;
+  if (!options_.headless) {
+    const auto acquire_start = Clock::now();
+    const VkResult result = vkAcquireNextImageKHR(
+        logical_.device, swapchain_.chain, UINT64_MAX, frame.image_available,
+        VK_NULL_HANDLE, &image_index);
+    timings.acquire_ms = millisecondsSince(acquire_start);
+    // Nothing was acquired, so skip the frame; the slot's fence is still
+    // signaled and the slot can be retried as is.
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      recreateSwapchain();
+      return;
+    }
+    // A suboptimal image is still presentable; recreate after presenting.
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      throw std::runtime_error("failed to acquire swap chain image!");
+    }
+  }
+  // Only counted once the frame is sure to be submitted: a skipped frame
+  // leaves the other slots' frames running.
+  graph_->beginFrame();
+
+  // With more frames in flight than swapchain images, or an out-of-order
+  // acquire, the image may still be rendered to by another slot.
+  VkFence &image_fence = images_in_flight_[image_index];
+  if (image_fence != VK_NULL_HANDLE && image_fence != frame.in_flight) {
+    vkWaitForFences(logical_.device, 1, &image_fence, VK_TRUE, UINT64_MAX);
+  }
+  image_fence = frame.in_flight;
+  vkResetFences(logical_.device, 1, &frame.in_flight);
+
+  VkCommandBuffer command_buffer = static_command_buffers_.empty()
+                                       ? frame.command_buffer
+                                       : static_command_buffers_[image_index];
+  if (!options_.static_scene) {
+    frame.resetCommandPools(logical_.device);
+    recordCommandBuffer(frame, image_index);
+  }
 
   VkSubmitInfo submit_info{};
   submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  VkSemaphore wait_semaphores[] = {image_available_semaphore_};
+  VkSemaphore wait_semaphores[] = {frame.image_available};
   VkPipelineStageFlags wait_stages[] = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submit_info.waitSemaphoreCount = 1;
+  // Headless frames have no acquire to wait on and no present to signal.
+  const uint32_t semaphore_count = options_.headless ? 0 : 1;
+  submit_info.waitSemaphoreCount = semaphore_count;
   submit_info.pWaitSemaphores = wait_semaphores;
   submit_info.pWaitDstStageMask = wait_stages;
   submit_info.commandBufferCount = 1;
-  submit_info.pCommandBuffers = &command_buffer_;
-  VkSemaphore signal_semaphores[] = {render_finished_semaphore_};
-  submit_info.signalSemaphoreCount = 1;
+  submit_info.pCommandBuffers = &command_buffer;
+  VkSemaphore signal_semaphores[] = {frame.render_finished};
+  submit_info.signalSemaphoreCount = semaphore_count;
   submit_info.pSignalSemaphores = signal_semaphores;
-  if (vkQueueSubmit(logical_.graphics, 1, &submit_info, in_flight_fence_) !=
+  const auto submit_start = Clock::now();
+  if (vkQueueSubmit(logical_.graphics, 1, &submit_info, frame.in_flight) !=
       VK_SUCCESS) {
     throw std::runtime_error("failed to submit draw command buffer!");
   }
+  timings.submit_ms = millisecondsSince(submit_start);
+  last_image_index_ = image_index;
+  current_frame_ = (current_frame_ + 1) % frames_.size();
+  if (options_.headless) {
+    timings.cpu_frame_ms = millisecondsSince(frame_start);
+    last_timings_ = timings;
+    return;
+  }
 
   VkPresentInfoKHR present_info{};
   present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -784,37 +1356,256 @@ void ComputerGraphicsApplication::drawFrame() {
   present_info.pSwapchains = swapchains;
   present_info.pImageIndices = &image_index;
   present_info.pResults = nullptr;
-  vkQueuePresentKHR(logical_.present, &present_info);
+  const auto present_start = Clock::now();
+  const VkResult result = vkQueuePresentKHR(logical_.present, &present_info);
+  timings.present_ms = millisecondsSince(present_start);
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
+      framebuffer_resized_) {
+    recreateSwapchain();
+  } else if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to present swap chain image!");
+  }
+  timings.cpu_frame_ms = millisecondsSince(frame_start);
+  last_timings_ = timings;
+}
+
+void ComputerGraphicsApplication::buildBatches() {
+  batcher_.clear();
+  for (uint32_t mesh = 0; mesh < meshes_.size(); ++mesh) {
+    frame_pipelines_[mesh] =
+        pipelines_->get(mesh_keys_[mesh], mesh_pipelines_[mesh]);
+  }
+  const auto add = [this](uint32_t instance) {
+    const uint32_t mesh = scene_meshes_[instance];
+    batcher_.add(frame_pipelines_[mesh], mesh, scene_instances_[instance]);
+  };
+  if (cpu_culling_) {
+    cullSpheres(getViewFrustum(frameUniforms()), scene_bounds_,
+                visible_instances_, jobs_.get());
+    for (const uint32_t instance : visible_instances_) {
+      add(instance);
+    }
+  } else {
+    for (uint32_t instance = 0; instance < scene_instances_.size();
+         ++instance) {
+      add(instance);
+    }
+  }
+  batcher_.build(jobs_.get());
+  if (options_.depth_prepass) {
+    batch_prepass_pipelines_.clear();
+    for (const auto &batch : batcher_.batches()) {
+      batch_prepass_pipelines_.push_back(mesh_prepass_pipelines_[batch.mesh]);
+    }
+  }
+}
+
+void ComputerGraphicsApplication::updateInstances() {
+  buildBatches();
+  if (streamer_) {
+    const float screen_size = getInstanceScreenSize(
+        options_.instance_count, camera_.zoom, swapchain_.extent);
+    const uint32_t used = std::min<uint32_t>(
+        static_cast<uint32_t>(options_.textures.size()),
+        options_.instance_count);
+    for (TextureStreamer::Handle texture = 0; texture < used; ++texture) {
+      streamer_->request(texture, screen_size);
+    }
+  }
+  instance_stream_.upload(*allocator_, current_frame_, batcher_.instances());
+
+  Frame &frame = frames_[current_frame_];
+  descriptors_->beginFrame(current_frame_);
+  uniforms_.beginFrame(current_frame_);
+  frame.uniform_offset = uniforms_.push(*allocator_, frameUniforms());
+  frame.descriptor_set = allocateFrameSet(*descriptors_, uniforms_);
 }
 
-void ComputerGraphicsApplication::recordCommandBuffer(
-    VkCommandBuffer command_buffer, uint32_t image_index) {
+FrameUniforms ComputerGraphicsApplication::frameUniforms() const {
+  const float zoom = camera_.zoom;
+  return {{zoom, 0.0f, 0.0f, zoom},
+          {-zoom * camera_.center[0], -zoom * camera_.center[1]}};
+}
+
+VkDescriptorSet ComputerGraphicsApplication::allocateFrameSet(
+    DescriptorAllocator &descriptors, const UniformRing &uniforms) const {
+  const VkDescriptorSet descriptor_set =
+      descriptors.allocate(frame_set_layout_);
+  VkDescriptorBufferInfo buffer_info{};
+  buffer_info.buffer = uniforms.buffer();
+  buffer_info.offset = 0;
+  buffer_info.range = sizeof(FrameUniforms);
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = descriptor_set;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  write.pBufferInfo = &buffer_info;
+  vkUpdateDescriptorSets(logical_.device, 1, &write, 0, nullptr);
+  return descriptor_set;
+}
+
+void ComputerGraphicsApplication::bindFrameSet(
+    VkCommandBuffer command_buffer, const VkDescriptorSet &descriptor_set,
+    uint32_t uniform_offset) const {
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeline_layout_, 0, 1, &descriptor_set, 1,
+                          &uniform_offset);
+  if (bindless_) {
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline_layout_, 1, 1, &bindless_->set(), 0,
+                            nullptr);
+  }
+}
+
+void ComputerGraphicsApplication::recordStaticCommandBuffers() {
+  // Re-recording is rare, so simply drain the queue rather than tracking
+  // which buffers are still pending.
+  vkDeviceWaitIdle(logical_.device);
+  recorded_pipeline_generation_ = pipelines_->generation();
+  buildBatches();
+  static_instances_.upload(*allocator_, 0, batcher_.instances());
+  static_descriptors_->beginFrame(0);
+  static_uniforms_.beginFrame(0);
+  static_uniform_offset_ = static_uniforms_.push(*allocator_, frameUniforms());
+  static_descriptor_set_ =
+      allocateFrameSet(*static_descriptors_, static_uniforms_);
+
+  vkResetCommandPool(logical_.device, static_command_pool_, 0);
+  // The swapchain may have been recreated with a different image count.
+  const size_t image_count = swapchain_.images.size();
+  while (static_command_buffers_.size() < image_count) {
+    static_command_buffers_.push_back(
+        createCommandBuffer(static_command_pool_, logical_.device));
+  }
+  if (static_command_buffers_.size() > image_count) {
+    vkFreeCommandBuffers(
+        logical_.device, static_command_pool_,
+        static_cast<uint32_t>(static_command_buffers_.size() - image_count),
+        static_command_buffers_.data() + image_count);
+    static_command_buffers_.resize(image_count);
+  }
+  for (uint32_t i = 0; i < image_count; ++i) {
+    const VkCommandBuffer command_buffer = static_command_buffers_[i];
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording command buffer!");
+    }
+    graph_->bindImage(target_, swapchain_.images[i], swapchain_.views[i]);
+    graph_->execute(command_buffer);
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer!");
+    }
+  }
+  commands_dirty_ = false;
+}
+
+void ComputerGraphicsApplication::recordBatches(
+    VkCommandBuffer command_buffer, uint32_t first_batch, uint32_t batch_count,
+    const std::vector<VkPipeline> *pipelines) const {
+  if (options_.static_scene) {
+    bindFrameSet(command_buffer, static_descriptor_set_,
+                 static_uniform_offset_);
+    batcher_.record(command_buffer, pipeline_layout_, meshes_,
+                    static_instances_.buffer(0), kInstanceBinding,
+                    first_batch, batch_count, pipelines);
+    return;
+  }
+  const Frame &frame = frames_[current_frame_];
+  bindFrameSet(command_buffer, frame.descriptor_set, frame.uniform_offset);
+  if (culler_) {
+    batcher_.recordIndirect(command_buffer, pipeline_layout_, meshes_,
+                            culler_->visibleBuffer(current_frame_),
+                            kInstanceBinding,
+                            culler_->indirectBuffer(current_frame_),
+                            first_batch, batch_count, pipelines);
+    return;
+  }
+  batcher_.record(command_buffer, pipeline_layout_, meshes_,
+                  instance_stream_.buffer(current_frame_), kInstanceBinding,
+                  first_batch, batch_count, pipelines);
+}
+
+void ComputerGraphicsApplication::recordWorkerCommandBuffers(
+    const Frame &frame, const PassContext &context) {
+  VkCommandBufferInheritanceInfo inheritance{};
+  inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance.renderPass = context.render_pass;
+  inheritance.subpass = 0;
+  inheritance.framebuffer = context.framebuffer;
+  const uint32_t batch_count =
+      static_cast<uint32_t>(batcher_.batches().size());
+  const uint32_t buffer_count =
+      static_cast<uint32_t>(frame.worker_buffers.size());
+  const uint32_t batches_per_buffer =
+      (batch_count + buffer_count - 1) / buffer_count;
+
+  // Each buffer has its own pool, so whichever thread runs its job may
+  // record it.
+  jobs_->parallelFor(buffer_count, 1, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t buffer = begin; buffer < end; ++buffer) {
+      const VkCommandBuffer command_buffer = frame.worker_buffers[buffer];
+      VkCommandBufferBeginInfo begin_info{};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                         VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+      begin_info.pInheritanceInfo = &inheritance;
+      if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+      }
+      setDynamicState(command_buffer, context.extent);
+      const uint32_t first_batch =
+          std::min(batch_count, buffer * batches_per_buffer);
+      recordBatches(command_buffer, first_batch,
+                    std::min(batches_per_buffer, batch_count - first_batch));
+      if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+      }
+    }
+  });
+}
+
+void ComputerGraphicsApplication::recordCommandBuffer(const Frame &frame,
+                                                      uint32_t image_index) {
+  const VkCommandBuffer command_buffer = frame.command_buffer;
   VkCommandBufferBeginInfo begin_info{};
   begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
   begin_info.flags = 0;
   begin_info.pInheritanceInfo = nullptr;
-  if (vkBeginCommandBuffer(command_buffer_, &begin_info) != VK_SUCCESS) {
+  if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
     throw std::runtime_error("failed to begin recording command buffer!");
   }
-
-  VkRenderPassBeginInfo render_pass_info{};
-  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  render_pass_info.renderPass = render_pass_;
-  render_pass_info.framebuffer = swapchain_.buffers[image_index];
-  render_pass_info.renderArea.offset = {0, 0};
-  render_pass_info.renderArea.extent = swapchain_.extent;
-  VkClearValue clear_value = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-  render_pass_info.clearValueCount = 1;
-  render_pass_info.pClearValues = &clear_value;
-
-  vkCmdBeginRenderPass(command_buffer_, &render_pass_info,
-                       VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(command_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    graphics_pipeline_);
-  vkCmdDraw(command_buffer_, 3, 1, 0, 0);
-  vkCmdEndRenderPass(command_buffer_);
-  if (vkEndCommandBuffer(command_buffer_) != VK_SUCCESS) {
+  gpu_profiler_->beginFrame(command_buffer, current_frame_);
+  const uint32_t frame_scope =
+      gpu_profiler_->beginScope(command_buffer, "frame");
+  graph_->bindImage(target_, swapchain_.images[image_index],
+                    swapchain_.views[image_index]);
+  graph_->execute(command_buffer, gpu_profiler_.get());
+  gpu_profiler_->endScope(command_buffer, frame_scope);
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
     throw std::runtime_error("failed to record command buffer!");
   }
 }
+
+void ComputerGraphicsApplication::recordDepthPrepass(
+    VkCommandBuffer command_buffer, const PassContext &context) {
+  setDynamicState(command_buffer, context.extent);
+  recordBatches(command_buffer, 0, UINT32_MAX, &batch_prepass_pipelines_);
+}
+
+void ComputerGraphicsApplication::recordMainPass(VkCommandBuffer command_buffer,
+                                                 const PassContext &context) {
+  if (options_.recording_threads > 0 && !options_.static_scene) {
+    const Frame &frame = frames_[current_frame_];
+    recordWorkerCommandBuffers(frame, context);
+    vkCmdExecuteCommands(command_buffer,
+                         static_cast<uint32_t>(frame.worker_buffers.size()),
+                         frame.worker_buffers.data());
+    return;
+  }
+  setDynamicState(command_buffer, context.extent);
+  recordBatches(command_buffer);
+}
 } // namespace cg
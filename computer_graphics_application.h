@@ -1,81 +1,383 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <optional>
+#include <string>
 #include <vector>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "benchmark.h"
+#include "bindless.h"
+#include "descriptors.h"
+#include "device_memory.h"
+#include "gpu_culling.h"
+#include "gpu_profiler.h"
+#include "instancing.h"
+#include "job_system.h"
+#include "mesh.h"
+#include "pipeline_cache.h"
+#include "pipeline_library.h"
+#include "render_graph.h"
+#include "texture.h"
+#include "texture_streaming.h"
+#include "visibility.h"
+
 namespace cg {
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphics_family;
   std::optional<uint32_t> present_family;
-  bool isComplete() const {
-    return graphics_family.has_value() && present_family.has_value();
+  // A family without graphics support, if the device exposes one. Uploads
+  // on it overlap with rendering instead of queueing behind it.
+  std::optional<uint32_t> transfer_family;
+  bool isComplete(bool headless = false) const {
+    return graphics_family.has_value() &&
+           (headless || present_family.has_value());
+  }
+  // The dedicated family, falling back to the graphics family.
+  uint32_t transferFamily() const {
+    return transfer_family.value_or(graphics_family.value());
   }
 };
 
 struct PhysicalDevice {
   VkPhysicalDevice device = VK_NULL_HANDLE;
   QueueFamilyIndices indices;
+  VkPhysicalDeviceProperties properties;
+  // Zero if the graphics queue does not support timestamp queries.
+  uint32_t timestamp_valid_bits = 0;
+  // Whether the Vulkan 1.2 descriptor indexing features bindless rendering
+  // needs are supported.
+  bool descriptor_indexing = false;
 };
 
 struct LogicalDevice {
   VkDevice device;
   VkQueue graphics;
   VkQueue present;
+  // Aliases graphics when the device has no dedicated family for it.
+  VkQueue transfer;
 
   void destroy() {}
 };
 
+// The images rendered into each frame. In headless mode there is no
+// VkSwapchainKHR (chain is VK_NULL_HANDLE) and the images are owned by the
+// application, backed by allocations.
 struct Swapchain {
-  VkSwapchainKHR chain;
+  VkSwapchainKHR chain = VK_NULL_HANDLE;
   VkFormat format;
   VkExtent2D extent;
 
   std::vector<VkImage> images;
+  std::vector<Allocation> allocations;
   std::vector<VkImageView> views;
-  std::vector<VkFramebuffer> buffers;
 
-  void destroy(const VkDevice &device) {
-    for (auto framebuffer : buffers) {
-      vkDestroyFramebuffer(device, framebuffer, nullptr);
-    }
+  void destroy(DeviceAllocator &allocator) {
+    const VkDevice &device = allocator.device();
     for (auto view : views) {
       vkDestroyImageView(device, view, nullptr);
     }
-    vkDestroySwapchainKHR(device, chain, nullptr);
+    if (chain != VK_NULL_HANDLE) {
+      vkDestroySwapchainKHR(device, chain, nullptr);
+      return;
+    }
+    for (size_t i = 0; i < images.size(); ++i) {
+      vkDestroyImage(device, images[i], nullptr);
+      allocator.free(allocations[i]);
+    }
+  }
+};
+
+// A swapchain replaced by recreation. It is destroyed once every fence of the
+// frames that rendered into its images has been seen signaled.
+struct RetiredSwapchain {
+  Swapchain swapchain;
+  std::vector<VkFence> pending_fences;
+};
+
+// Upper bound on the depth of the per-frame resource ring. Deeper rings add
+// latency without buying more CPU/GPU overlap.
+constexpr uint32_t kMaxFramesInFlight = 4;
+
+struct ApplicationOptions {
+  // Number of frames the CPU may record ahead of the GPU, in [1, 4].
+  uint32_t frames_in_flight = 2;
+  // Render into offscreen images without a window, surface or swapchain.
+  bool headless = false;
+  // Size of the offscreen images, or the initial window size.
+  uint32_t width = 800;
+  uint32_t height = 600;
+  // Number of frames run() draws in headless mode.
+  uint32_t frame_count = 1;
+  // Log average GPU scope timings every this many frames; 0 disables.
+  uint32_t gpu_log_interval = 0;
+  // Where the pipeline cache persists between runs; empty disables it.
+  std::string pipeline_cache_path = "pipeline_cache.bin";
+  // Also save the pipeline cache every this many seconds; 0 saves only on
+  // shutdown.
+  uint32_t pipeline_cache_save_interval = 0;
+  // Threads compiling pipeline permutations in the background.
+  uint32_t pipeline_compile_threads = 1;
+  // Copies of each mesh drawn per frame, laid out on a grid.
+  uint32_t instance_count = 1;
+  // Worker threads of the job system, which runs the frame's parallel CPU
+  // work alongside the calling thread. Unset uses every other hardware
+  // thread; 0 runs all jobs on the calling thread.
+  std::optional<uint32_t> job_threads;
+  // Secondary command buffers the main pass is split into, recorded in
+  // parallel as jobs; 0 records the frame inline on the calling thread.
+  uint32_t recording_threads = 0;
+  // Record one command buffer per swapchain image up front and resubmit them
+  // unchanged, re-recording only after markSceneDirty(). GPU scope timings
+  // are not collected in this mode.
+  bool static_scene = false;
+  // Cull instances against the view in a compute pass and draw the
+  // survivors indirectly. Ignored for static scenes.
+  bool gpu_culling = false;
+  // Cull instances against the view on the CPU, with the widest vector
+  // instructions available, before batching them. Ignored with GPU culling
+  // and for static scenes.
+  bool cpu_culling = false;
+  // Draw through one bound table of every texture and material, selected per
+  // instance by InstanceData::material. Requires descriptor indexing.
+  bool bindless = false;
+  // Lay down depth in a depth-only pass before shading, so the main pass
+  // shades each pixel once instead of once per overlapping instance.
+  bool depth_prepass = false;
+  // Samples per pixel, rounded down to a count the device supports for both
+  // color and depth attachments; 1 disables multisampling. The samples are
+  // resolved into the swapchain image at the end of the main pass.
+  uint32_t msaa_samples = 1;
+  // Binary mesh file to draw instead of the built-in triangle; see
+  // mesh_format.h.
+  std::string mesh_file;
+  // PPM images streamed in as the instances' textures, assigned round-robin.
+  // Requires bindless; ignored for static scenes.
+  std::vector<std::string> textures;
+  // Device memory the streamed textures may occupy, in MiB.
+  uint32_t texture_budget_mb = 256;
+};
+
+// 2D camera: the world point at center maps to the middle of the viewport,
+// scaled by zoom.
+struct Camera {
+  float center[2] = {0.0f, 0.0f};
+  float zoom = 1.0f;
+};
+
+// A frame read back from the GPU as tightly packed RGBA8 rows.
+struct FrameImage {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> pixels;
+};
+
+// Resources owned by one slot of the frames-in-flight ring. A slot is reused
+// only after its fence signals, so everything here is safe to reset on reuse.
+struct Frame {
+  // Command pools are reset wholesale on reuse instead of per buffer.
+  VkCommandPool command_pool;
+  VkCommandBuffer command_buffer;
+  // One pool and secondary command buffer per recording job; empty when
+  // recording inline.
+  std::vector<VkCommandPool> worker_pools;
+  std::vector<VkCommandBuffer> worker_buffers;
+  VkSemaphore image_available;
+  VkSemaphore render_finished;
+  VkFence in_flight;
+  // Set 0 of the frame's draws and the dynamic offset of its FrameUniforms.
+  VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+  uint32_t uniform_offset = 0;
+
+  void resetCommandPools(const VkDevice &device) {
+    vkResetCommandPool(device, command_pool, 0);
+    for (auto pool : worker_pools) {
+      vkResetCommandPool(device, pool, 0);
+    }
+  }
+
+  void destroy(const VkDevice &device) {
+    vkDestroyCommandPool(device, command_pool, nullptr);
+    for (auto pool : worker_pools) {
+      vkDestroyCommandPool(device, pool, nullptr);
+    }
+    vkDestroySemaphore(device, image_available, nullptr);
+    vkDestroySemaphore(device, render_finished, nullptr);
+    vkDestroyFence(device, in_flight, nullptr);
   }
 };
 
 class ComputerGraphicsApplication {
 public:
-  ComputerGraphicsApplication();
+  explicit ComputerGraphicsApplication(const ApplicationOptions &options = {});
   ~ComputerGraphicsApplication();
 
   void run();
 
+  // Copies the most recently drawn frame back to host memory, waiting for it
+  // to finish rendering. Only available in headless mode, once a frame has
+  // been drawn.
+  FrameImage readbackFrame();
+
+  // Draws warmup_frames untimed frames, then frame_count timed ones.
+  BenchmarkReport benchmark(uint32_t frame_count, uint32_t warmup_frames);
+
+  // Makes a static scene re-record its command buffers before the next
+  // frame. Not needed otherwise, as every frame is recorded from scratch.
+  void markSceneDirty() { commands_dirty_ = true; }
+
+  const Camera &camera() const { return camera_; }
+  void setCamera(const Camera &camera) {
+    camera_ = camera;
+    markSceneDirty();
+  }
+
+  const FrameTimings &lastFrameTimings() const { return last_timings_; }
+  const GpuProfiler &gpuProfiler() const { return *gpu_profiler_; }
+  AllocatorStatistics memoryStatistics() const {
+    return allocator_->statistics();
+  }
+  TextureStreamingStatistics textureStatistics() const {
+    return streamer_ ? streamer_->statistics() : TextureStreamingStatistics{};
+  }
+  RenderGraphStatistics renderGraphStatistics() const {
+    return graph_->statistics();
+  }
+
 private:
+  // Processes window events; false once the window has been asked to close.
+  bool pollWindow();
+  // Replaces swapchain_ with one matching the surface, retiring the old one
+  // without waiting for the device. False while the window is minimized.
+  bool recreateSwapchain();
+  void releaseRetiredSwapchains();
+  // Declares and compiles the frame's passes for the current swapchain.
+  void buildFrameGraph();
   void drawFrame();
-  void recordCommandBuffer(VkCommandBuffer command_buffer,
-                           uint32_t image_index);
+  void buildBatches();
+  // Rebuilds this frame's draw batches and uploads their instance data.
+  void updateInstances();
+  FrameUniforms frameUniforms() const;
+  // Allocates a set 0 from descriptors that reads FrameUniforms from
+  // uniforms at a dynamic offset.
+  VkDescriptorSet allocateFrameSet(DescriptorAllocator &descriptors,
+                                   const UniformRing &uniforms) const;
+  // Also binds the bindless table as set 1, if any.
+  void bindFrameSet(VkCommandBuffer command_buffer,
+                    const VkDescriptorSet &descriptor_set,
+                    uint32_t uniform_offset) const;
+  // Waits for the device to go idle, then re-records every pre-recorded
+  // command buffer from freshly built batches.
+  void recordStaticCommandBuffers();
+  void recordCommandBuffer(const Frame &frame, uint32_t image_index);
+  // Records the depth-only draws of the prepass, inline.
+  void recordDepthPrepass(VkCommandBuffer command_buffer,
+                          const PassContext &context);
+  // Records the draws of the main render pass.
+  void recordMainPass(VkCommandBuffer command_buffer,
+                      const PassContext &context);
+  // Splits the draw batches into one job per secondary command buffer of
+  // the frame, each recording its share into its buffer.
+  void recordWorkerCommandBuffers(const Frame &frame,
+                                  const PassContext &context);
+  // Records the batches in [first_batch, first_batch + batch_count) of the
+  // current frame, or of the static scene, drawing indirectly from the
+  // culling results if enabled. pipelines is as for DrawBatcher::record().
+  void recordBatches(VkCommandBuffer command_buffer, uint32_t first_batch = 0,
+                     uint32_t batch_count = UINT32_MAX,
+                     const std::vector<VkPipeline> *pipelines = nullptr) const;
 
-  GLFWwindow *window_;
+  ApplicationOptions options_;
+  GLFWwindow *window_ = nullptr;
   VkInstance instance_;
-  VkSurfaceKHR surface_;
+  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
 
   PhysicalDevice physical_;
   LogicalDevice logical_;
+  std::unique_ptr<DeviceAllocator> allocator_;
   Swapchain swapchain_;
+  std::vector<RetiredSwapchain> retired_swapchains_;
+  bool framebuffer_resized_ = false;
 
-  VkRenderPass render_pass_;
+  std::unique_ptr<RenderGraph> graph_;
+  // The image of the frame being recorded, bound per swapchain image.
+  RenderGraph::Resource target_;
+  RenderGraph::Pass main_pass_;
+  // Depth prepass mode only.
+  RenderGraph::Pass prepass_;
+  VkFormat depth_format_;
+  VkSampleCountFlagBits samples_;
+  std::unique_ptr<PipelineCache> pipeline_cache_;
+  std::unique_ptr<DescriptorSetLayoutCache> set_layouts_;
+  // Owned by set_layouts_.
+  VkDescriptorSetLayout frame_set_layout_;
   VkPipelineLayout pipeline_layout_;
+  std::unique_ptr<PipelineLibrary> pipelines_;
+  PipelineKey pipeline_key_;
+  // Owned by pipelines_.
   VkPipeline graphics_pipeline_;
+  // Per mesh of meshes_: the key of the pipeline drawing it, which differs
+  // from pipeline_key_ in the vertex formats of mesh files, and that
+  // pipeline compiled up front as the fallback.
+  std::vector<PipelineKey> mesh_keys_;
+  std::vector<VkPipeline> mesh_pipelines_;
+  // Depth prepass mode only: the depth-only variant of each mesh's pipeline,
+  // and of each batch's, as drawn by the prepass.
+  std::vector<VkPipeline> mesh_prepass_pipelines_;
+  std::vector<VkPipeline> batch_prepass_pipelines_;
   VkCommandPool command_pool_;
-  VkCommandBuffer command_buffer_;
+  VkCommandPool transfer_pool_;
+  UploadBatch upload_batch_;
+  std::vector<Mesh> meshes_;
+  DrawBatcher batcher_;
+  InstanceStream instance_stream_;
+  std::unique_ptr<GpuCuller> culler_;
+  std::unique_ptr<DescriptorAllocator> descriptors_;
+  UniformRing uniforms_;
+  // Bindless mode only; set 1 of every draw. Slot 0 of each table holds a
+  // white default texture and material.
+  std::unique_ptr<BindlessTable> bindless_;
+  std::unique_ptr<SamplerCache> samplers_;
+  Texture default_texture_;
+  // Streams options_.textures, whose materials the instances cycle through.
+  std::unique_ptr<TextureStreamer> streamer_;
+  std::vector<uint32_t> texture_materials_;
+  // Every instance drawn, with the mesh it draws, laid out once.
+  std::vector<InstanceData> scene_instances_;
+  std::vector<uint32_t> scene_meshes_;
+  // The pipeline drawing each mesh this frame.
+  std::vector<VkPipeline> frame_pipelines_;
+  bool cpu_culling_ = false;
+  // CPU culling only: the bounds of scene_instances_, and the instances
+  // visible this frame.
+  BoundsArray scene_bounds_;
+  std::vector<uint32_t> visible_instances_;
+  Camera camera_;
+
+  std::vector<Frame> frames_;
+  uint32_t current_frame_ = 0;
+  // Fence of the frame that last rendered into each swapchain image, or
+  // VK_NULL_HANDLE if the image has not been used yet.
+  std::vector<VkFence> images_in_flight_;
+  uint32_t last_image_index_ = 0;
+  uint64_t frame_number_ = 0;
+  FrameTimings last_timings_;
+  std::unique_ptr<GpuProfiler> gpu_profiler_;
+  std::unique_ptr<JobSystem> jobs_;
 
-  VkSemaphore image_available_semaphore_;
-  VkSemaphore render_finished_semaphore_;
-  VkFence in_flight_fence_;
+  // Static scene mode: one command buffer per swapchain image.
+  VkCommandPool static_command_pool_ = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> static_command_buffers_;
+  InstanceStream static_instances_;
+  std::unique_ptr<DescriptorAllocator> static_descriptors_;
+  UniformRing static_uniforms_;
+  VkDescriptorSet static_descriptor_set_ = VK_NULL_HANDLE;
+  uint32_t static_uniform_offset_ = 0;
+  bool commands_dirty_ = true;
+  // PipelineLibrary::generation() when the buffers were last recorded.
+  uint64_t recorded_pipeline_generation_ = 0;
 };
 } // namespace cg
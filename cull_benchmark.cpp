@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "visibility.h"
+
+// Measures cg::cullSpheres() in objects per second per core: each path on
+// one thread, then the best path spread over a job system.
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+uint32_t parseUint(const char *value, const char *flag) {
+  try {
+    return static_cast<uint32_t>(std::stoul(value));
+  } catch (const std::exception &) {
+    throw std::runtime_error(std::string("invalid value for ") + flag + ": " +
+                             value);
+  }
+}
+
+// Spheres scattered over twice the view in x and y and past both depth
+// planes, so that about a fifth are visible.
+cg::BoundsArray createBounds(uint32_t count) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-2.0f, 2.0f);
+  std::uniform_real_distribution<float> depth(-0.25f, 1.25f);
+  std::uniform_real_distribution<float> radius(0.0f, 0.01f);
+  cg::BoundsArray bounds;
+  bounds.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    bounds.add(position(random), position(random), depth(random),
+               radius(random));
+  }
+  return bounds;
+}
+
+// Fastest of iterations runs of cull, in seconds.
+template <typename Cull> double timeBest(uint32_t iterations, Cull cull) {
+  double best = 0.0;
+  for (uint32_t i = 0; i < iterations; ++i) {
+    const auto start = Clock::now();
+    cull();
+    const double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    best = i == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+void printRate(const std::string &name, uint32_t count, double seconds,
+               uint32_t cores, uint32_t visible_count) {
+  std::cout << std::left << std::setw(16) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10)
+            << count / seconds / cores * 1e-6 << " M objects/s/core"
+            << std::setw(10) << visible_count << " visible" << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    uint32_t object_count = 1u << 20;
+    uint32_t iterations = 50;
+    uint32_t thread_count =
+        std::max(std::thread::hardware_concurrency(), 1u) - 1;
+    for (int i = 1; i < argc; ++i) {
+      const char *flag = argv[i];
+      if (std::strcmp(flag, "--objects") == 0 && i + 1 < argc) {
+        object_count = parseUint(argv[++i], flag);
+      } else if (std::strcmp(flag, "--iterations") == 0 && i + 1 < argc) {
+        iterations = std::max(parseUint(argv[++i], flag), 1u);
+      } else if (std::strcmp(flag, "--threads") == 0 && i + 1 < argc) {
+        thread_count = parseUint(argv[++i], flag);
+      } else {
+        std::cerr << "usage: " << argv[0]
+                  << " [--objects N] [--iterations N] [--threads N]"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
+    const cg::BoundsArray bounds = createBounds(object_count);
+    const cg::Frustum frustum =
+        cg::getViewFrustum({{1.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 0.0f}});
+    std::vector<uint32_t> expected(object_count);
+    expected.resize(cg::cullSpheres(frustum, bounds, 0, object_count,
+                                    expected.data(), cg::CullPath::kScalar));
+
+    std::vector<cg::CullPath> paths = {cg::CullPath::kScalar};
+    if (cg::getBestCullPath() != cg::CullPath::kScalar) {
+      paths.push_back(cg::CullPath::kSse2);
+    }
+    if (cg::getBestCullPath() == cg::CullPath::kAvx2) {
+      paths.push_back(cg::CullPath::kAvx2);
+    }
+    std::vector<uint32_t> visible(object_count);
+    for (const auto path : paths) {
+      uint32_t visible_count = 0;
+      const double seconds = timeBest(iterations, [&] {
+        visible_count = cg::cullSpheres(frustum, bounds, 0, object_count,
+                                        visible.data(), path);
+      });
+      if (visible_count != expected.size() ||
+          !std::equal(expected.begin(), expected.end(), visible.begin())) {
+        throw std::runtime_error(std::string(cg::getCullPathName(path)) +
+                                 " disagrees with the scalar path");
+      }
+      printRate(cg::getCullPathName(path), object_count, seconds, 1,
+                visible_count);
+    }
+
+    cg::JobSystem jobs(thread_count, 1);
+    const double seconds = timeBest(iterations, [&] {
+      cg::cullSpheres(frustum, bounds, visible, &jobs);
+    });
+    if (visible != expected) {
+      throw std::runtime_error("the job system disagrees with one thread");
+    }
+    printRate(std::string(cg::getCullPathName(cg::getBestCullPath())) + " x" +
+                  std::to_string(jobs.concurrency()),
+              object_count, seconds, jobs.concurrency(),
+              static_cast<uint32_t>(visible.size()));
+  } catch (const std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
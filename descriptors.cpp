@@ -0,0 +1,154 @@
+#include "descriptors.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "hash.h"
+
+namespace cg {
+namespace {
+// Descriptors of each type per set a pool is sized for. Pools are
+// reset every frame, so a generous mix costs little.
+struct PoolRatio {
+  VkDescriptorType type;
+  float ratio;
+};
+constexpr PoolRatio kPoolRatios[] = {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f},
+};
+} // namespace
+
+bool DescriptorSetLayoutCache::Key::operator==(const Key &other) const {
+  return std::equal(
+      bindings.begin(), bindings.end(), other.bindings.begin(),
+      other.bindings.end(),
+      [](const VkDescriptorSetLayoutBinding &a,
+         const VkDescriptorSetLayoutBinding &b) {
+        return a.binding == b.binding &&
+               a.descriptorType == b.descriptorType &&
+               a.descriptorCount == b.descriptorCount &&
+               a.stageFlags == b.stageFlags;
+      });
+}
+
+size_t DescriptorSetLayoutCache::KeyHash::operator()(const Key &key) const {
+  size_t seed = key.bindings.size();
+  for (const auto &binding : key.bindings) {
+    hashCombine(seed, binding.binding);
+    hashCombine(seed, static_cast<uint32_t>(binding.descriptorType));
+    hashCombine(seed, binding.descriptorCount);
+    hashCombine(seed, binding.stageFlags);
+  }
+  return seed;
+}
+
+VkDescriptorSetLayout DescriptorSetLayoutCache::get(
+    std::vector<VkDescriptorSetLayoutBinding> bindings) {
+  std::sort(bindings.begin(), bindings.end(),
+            [](const auto &a, const auto &b) { return a.binding < b.binding; });
+  Key key{std::move(bindings)};
+  auto it = layouts_.find(key);
+  if (it != layouts_.end()) {
+    return it->second;
+  }
+
+  VkDescriptorSetLayoutCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  info.bindingCount = static_cast<uint32_t>(key.bindings.size());
+  info.pBindings = key.bindings.data();
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(device_, &info, nullptr, &layout) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor set layout!");
+  }
+  layouts_.emplace(std::move(key), layout);
+  return layout;
+}
+
+void DescriptorSetLayoutCache::destroy() {
+  for (const auto &[key, layout] : layouts_) {
+    vkDestroyDescriptorSetLayout(device_, layout, nullptr);
+  }
+  layouts_.clear();
+}
+
+DescriptorAllocator::DescriptorAllocator(const VkDevice &device,
+                                         uint32_t frame_count,
+                                         uint32_t sets_per_pool)
+    : device_(device), sets_per_pool_(sets_per_pool), frames_(frame_count) {}
+
+void DescriptorAllocator::beginFrame(uint32_t frame_index) {
+  FramePools &pools = frames_[frame_index];
+  for (auto pool : pools.used) {
+    vkResetDescriptorPool(device_, pool, 0);
+    pools.free.push_back(pool);
+  }
+  pools.used.clear();
+  current_frame_ = frame_index;
+}
+
+VkDescriptorSet
+DescriptorAllocator::allocate(const VkDescriptorSetLayout &layout) {
+  FramePools &pools = frames_[current_frame_];
+  VkDescriptorSetAllocateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  info.descriptorSetCount = 1;
+  info.pSetLayouts = &layout;
+  VkDescriptorSet set;
+  if (!pools.used.empty()) {
+    info.descriptorPool = pools.used.back();
+    if (vkAllocateDescriptorSets(device_, &info, &set) == VK_SUCCESS) {
+      return set;
+    }
+  }
+  // Without VK_KHR_maintenance1 an exhausted pool is not reported as
+  // VK_ERROR_OUT_OF_POOL_MEMORY, so any failure moves on to a fresh pool,
+  // which must then satisfy the request.
+  info.descriptorPool = nextPool(pools);
+  if (vkAllocateDescriptorSets(device_, &info, &set) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate descriptor set!");
+  }
+  return set;
+}
+
+VkDescriptorPool DescriptorAllocator::nextPool(FramePools &pools) {
+  if (!pools.free.empty()) {
+    pools.used.push_back(pools.free.back());
+    pools.free.pop_back();
+    return pools.used.back();
+  }
+  std::vector<VkDescriptorPoolSize> sizes;
+  for (const auto &ratio : kPoolRatios) {
+    sizes.push_back(
+        {ratio.type, static_cast<uint32_t>(ratio.ratio * sets_per_pool_)});
+  }
+  VkDescriptorPoolCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  info.maxSets = sets_per_pool_;
+  info.poolSizeCount = static_cast<uint32_t>(sizes.size());
+  info.pPoolSizes = sizes.data();
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(device_, &info, nullptr, &pool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor pool!");
+  }
+  pools.used.push_back(pool);
+  return pool;
+}
+
+void DescriptorAllocator::destroy() {
+  for (auto &pools : frames_) {
+    for (auto pool : pools.used) {
+      vkDestroyDescriptorPool(device_, pool, nullptr);
+    }
+    for (auto pool : pools.free) {
+      vkDestroyDescriptorPool(device_, pool, nullptr);
+    }
+  }
+  frames_.clear();
+}
+} // namespace cg
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+namespace cg {
+// Deduplicates descriptor set layouts by their bindings, so that every user
+// of the same interface gets the same handle. Immutable samplers are not
+// supported.
+class DescriptorSetLayoutCache {
+public:
+  explicit DescriptorSetLayoutCache(const VkDevice &device) : device_(device) {}
+
+  // Owned by the cache. The order of bindings does not matter.
+  VkDescriptorSetLayout
+  get(std::vector<VkDescriptorSetLayoutBinding> bindings);
+  void destroy();
+
+private:
+  struct Key {
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    bool operator==(const Key &other) const;
+  };
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  VkDevice device_;
+  std::unordered_map<Key, VkDescriptorSetLayout, KeyHash> layouts_;
+};
+
+// Hands out descriptor sets that live until their frame slot comes around
+// again. Sets are never freed individually; beginFrame() resets the slot's
+// pools wholesale. Not thread-safe: allocate on the recording thread.
+class DescriptorAllocator {
+public:
+  DescriptorAllocator(const VkDevice &device, uint32_t frame_count,
+                      uint32_t sets_per_pool = 256);
+
+  // Resets the slot's pools; call after waiting on its fence.
+  void beginFrame(uint32_t frame_index);
+  VkDescriptorSet allocate(const VkDescriptorSetLayout &layout);
+  void destroy();
+
+private:
+  struct FramePools {
+    // Pools handed out from since the last reset; the last one is current.
+    std::vector<VkDescriptorPool> used;
+    std::vector<VkDescriptorPool> free;
+  };
+
+  VkDescriptorPool nextPool(FramePools &pools);
+
+  VkDevice device_;
+  uint32_t sets_per_pool_;
+  std::vector<FramePools> frames_;
+  uint32_t current_frame_ = 0;
+};
+} // namespace cg
@@ -0,0 +1,341 @@
+#include "device_memory.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+struct MemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  uint8_t *mapped = nullptr;
+  // Free ranges keyed by offset, never adjacent to each other.
+  std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+  VkDeviceSize used = 0;
+  uint32_t allocation_count = 0;
+
+  std::optional<VkDeviceSize> allocate(VkDeviceSize request,
+                                       VkDeviceSize alignment) {
+    auto best = free_ranges.end();
+    VkDeviceSize best_offset = 0;
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+      const VkDeviceSize offset = alignUp(it->first, alignment);
+      if (offset + request > it->first + it->second) {
+        continue;
+      }
+      if (best == free_ranges.end() || it->second < best->second) {
+        best = it;
+        best_offset = offset;
+      }
+    }
+    if (best == free_ranges.end()) {
+      return std::nullopt;
+    }
+    const VkDeviceSize range_offset = best->first;
+    const VkDeviceSize range_end = best->first + best->second;
+    free_ranges.erase(best);
+    if (best_offset > range_offset) {
+      free_ranges[range_offset] = best_offset - range_offset;
+    }
+    if (best_offset + request < range_end) {
+      free_ranges[best_offset + request] = range_end - best_offset - request;
+    }
+    used += request;
+    ++allocation_count;
+    return best_offset;
+  }
+
+  void free(VkDeviceSize offset, VkDeviceSize request) {
+    used -= request;
+    --allocation_count;
+    auto next = free_ranges.lower_bound(offset);
+    if (next != free_ranges.end() && offset + request == next->first) {
+      request += next->second;
+      next = free_ranges.erase(next);
+    }
+    if (next != free_ranges.begin()) {
+      auto previous = std::prev(next);
+      if (previous->first + previous->second == offset) {
+        previous->second += request;
+        return;
+      }
+    }
+    free_ranges[offset] = request;
+  }
+};
+
+DeviceAllocator::DeviceAllocator(const VkPhysicalDevice &physical_device,
+                                 const VkDevice &device,
+                                 VkDeviceSize block_size)
+    : device_(device), block_size_(block_size) {
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties_);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  buffer_image_granularity_ = properties.limits.bufferImageGranularity;
+  non_coherent_atom_size_ = properties.limits.nonCoherentAtomSize;
+  blocks_.resize(memory_properties_.memoryTypeCount);
+}
+
+DeviceAllocator::~DeviceAllocator() {
+  for (auto &type_blocks : blocks_) {
+    for (auto &block : type_blocks) {
+      vkFreeMemory(device_, block->memory, nullptr);
+    }
+  }
+}
+
+std::optional<uint32_t>
+DeviceAllocator::findMemoryType(uint32_t type_bits,
+                                VkMemoryPropertyFlags flags) const {
+  for (uint32_t i = 0; i < memory_properties_.memoryTypeCount; ++i) {
+    if ((type_bits & (1u << i)) &&
+        (memory_properties_.memoryTypes[i].propertyFlags & flags) == flags) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+VkDeviceMemory DeviceAllocator::allocateMemory(VkDeviceSize size,
+                                               uint32_t memory_type,
+                                               void **mapped) {
+  VkMemoryAllocateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  info.allocationSize = size;
+  info.memoryTypeIndex = memory_type;
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device_, &info, nullptr, &memory) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory!");
+  }
+  *mapped = nullptr;
+  if (memoryTypeFlags(memory_type) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(device_, memory, 0, VK_WHOLE_SIZE, 0, mapped) !=
+        VK_SUCCESS) {
+      vkFreeMemory(device_, memory, nullptr);
+      throw std::runtime_error("failed to map device memory!");
+    }
+  }
+  return memory;
+}
+
+Allocation DeviceAllocator::allocateDedicated(VkDeviceSize size,
+                                              uint32_t memory_type) {
+  Allocation allocation;
+  allocation.memory = allocateMemory(size, memory_type, &allocation.mapped);
+  allocation.size = size;
+  allocation.memory_type = memory_type;
+  ++dedicated_count_;
+  dedicated_bytes_ += size;
+  return allocation;
+}
+
+Allocation DeviceAllocator::allocate(const VkMemoryRequirements &requirements,
+                                     VkMemoryPropertyFlags required,
+                                     VkMemoryPropertyFlags preferred,
+                                     bool linear) {
+  std::optional<uint32_t> memory_type =
+      findMemoryType(requirements.memoryTypeBits, required | preferred);
+  if (!memory_type.has_value()) {
+    memory_type = findMemoryType(requirements.memoryTypeBits, required);
+  }
+  if (!memory_type.has_value()) {
+    throw std::runtime_error("failed to find suitable memory type!");
+  }
+
+  VkDeviceSize size = requirements.size;
+  VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+  if (!linear) {
+    alignment = std::max(alignment, buffer_image_granularity_);
+    size = alignUp(size, buffer_image_granularity_);
+  }
+  const VkMemoryPropertyFlags flags = memoryTypeFlags(memory_type.value());
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    // Keeps flush() ranges from touching a neighbouring allocation.
+    alignment = std::max(alignment, non_coherent_atom_size_);
+    size = alignUp(size, non_coherent_atom_size_);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const uint32_t heap =
+      memory_properties_.memoryTypes[memory_type.value()].heapIndex;
+  const VkDeviceSize block_size =
+      std::min(block_size_, memory_properties_.memoryHeaps[heap].size / 8);
+  if (size > block_size / 2) {
+    return allocateDedicated(size, memory_type.value());
+  }
+
+  auto &type_blocks = blocks_[memory_type.value()];
+  for (auto &block : type_blocks) {
+    if (block->size - block->used < size) {
+      continue;
+    }
+    if (const auto offset = block->allocate(size, alignment)) {
+      return {
+          .memory = block->memory,
+          .offset = offset.value(),
+          .size = size,
+          .mapped = block->mapped ? block->mapped + offset.value() : nullptr,
+          .memory_type = memory_type.value(),
+          .block = block.get(),
+      };
+    }
+  }
+
+  auto block = std::make_unique<MemoryBlock>();
+  void *mapped;
+  block->memory = allocateMemory(block_size, memory_type.value(), &mapped);
+  block->mapped = static_cast<uint8_t *>(mapped);
+  block->size = block_size;
+  block->free_ranges[0] = block_size;
+  const VkDeviceSize offset = block->allocate(size, alignment).value();
+  type_blocks.push_back(std::move(block));
+  MemoryBlock *new_block = type_blocks.back().get();
+  return {
+      .memory = new_block->memory,
+      .offset = offset,
+      .size = size,
+      .mapped = new_block->mapped ? new_block->mapped + offset : nullptr,
+      .memory_type = memory_type.value(),
+      .block = new_block,
+  };
+}
+
+Allocation DeviceAllocator::allocateForBuffer(const VkBuffer &buffer,
+                                              VkMemoryPropertyFlags required,
+                                              VkMemoryPropertyFlags preferred) {
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device_, buffer, &requirements);
+  Allocation allocation = allocate(requirements, required, preferred, true);
+  vkBindBufferMemory(device_, buffer, allocation.memory, allocation.offset);
+  return allocation;
+}
+
+Allocation DeviceAllocator::allocateForImage(const VkImage &image,
+                                             VkMemoryPropertyFlags required,
+                                             VkMemoryPropertyFlags preferred) {
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device_, image, &requirements);
+  Allocation allocation = allocate(requirements, required, preferred, false);
+  vkBindImageMemory(device_, image, allocation.memory, allocation.offset);
+  return allocation;
+}
+
+void DeviceAllocator::free(const Allocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (allocation.block == nullptr) {
+    vkFreeMemory(device_, allocation.memory, nullptr);
+    --dedicated_count_;
+    dedicated_bytes_ -= allocation.size;
+    return;
+  }
+  MemoryBlock *block = allocation.block;
+  block->free(allocation.offset, allocation.size);
+  if (block->allocation_count > 0) {
+    return;
+  }
+  // Keep one empty block per memory type around to avoid thrashing.
+  auto &type_blocks = blocks_[allocation.memory_type];
+  const auto empty_blocks =
+      std::count_if(type_blocks.begin(), type_blocks.end(),
+                    [](const auto &b) { return b->allocation_count == 0; });
+  if (empty_blocks <= 1) {
+    return;
+  }
+  vkFreeMemory(device_, block->memory, nullptr);
+  type_blocks.erase(std::find_if(
+      type_blocks.begin(), type_blocks.end(),
+      [block](const auto &b) { return b.get() == block; }));
+}
+
+void DeviceAllocator::flush(const Allocation &allocation) const {
+  if (memoryTypeFlags(allocation.memory_type) &
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+    return;
+  }
+  VkMappedMemoryRange range{};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = allocation.memory;
+  range.offset = allocation.offset;
+  range.size = allocation.size;
+  vkFlushMappedMemoryRanges(device_, 1, &range);
+}
+
+AllocatorStatistics DeviceAllocator::statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  AllocatorStatistics stats;
+  stats.dedicated_count = dedicated_count_;
+  stats.allocation_count = dedicated_count_;
+  stats.bytes_reserved = dedicated_bytes_;
+  stats.bytes_used = dedicated_bytes_;
+  VkDeviceSize free_bytes = 0;
+  for (const auto &type_blocks : blocks_) {
+    for (const auto &block : type_blocks) {
+      ++stats.block_count;
+      stats.allocation_count += block->allocation_count;
+      stats.bytes_reserved += block->size;
+      stats.bytes_used += block->used;
+      for (const auto &[offset, size] : block->free_ranges) {
+        free_bytes += size;
+        stats.largest_free_range = std::max(stats.largest_free_range, size);
+      }
+    }
+  }
+  if (free_bytes > 0) {
+    stats.fragmentation =
+        1.0 - static_cast<double>(stats.largest_free_range) / free_bytes;
+  }
+  return stats;
+}
+
+std::optional<VkDeviceSize> LinearAllocator::allocate(VkDeviceSize size,
+                                                      VkDeviceSize alignment) {
+  const VkDeviceSize offset =
+      alignUp(head_, std::max<VkDeviceSize>(alignment, 1));
+  if (offset + size > capacity_) {
+    return std::nullopt;
+  }
+  head_ = offset + size;
+  return offset;
+}
+
+RingAllocator::RingAllocator(VkDeviceSize capacity, uint32_t frame_count)
+    : capacity_(capacity), frame_sizes_(frame_count, 0) {}
+
+void RingAllocator::beginFrame(uint32_t frame_index) {
+  used_ -= frame_sizes_[frame_index];
+  frame_sizes_[frame_index] = 0;
+  current_frame_ = frame_index;
+}
+
+std::optional<VkDeviceSize> RingAllocator::allocate(VkDeviceSize size,
+                                                    VkDeviceSize alignment) {
+  // With nothing in flight, start over rather than charge wrap padding to an
+  // empty ring.
+  if (used_ == 0) {
+    head_ = 0;
+  }
+  VkDeviceSize offset = alignUp(head_, std::max<VkDeviceSize>(alignment, 1));
+  if (offset + size > capacity_) {
+    offset = 0;
+  }
+  // Padding skipped at the end of the ring counts against this frame.
+  const VkDeviceSize consumed =
+      (offset >= head_ ? offset - head_ : capacity_ - head_) + size;
+  if (used_ + consumed > capacity_) {
+    return std::nullopt;
+  }
+  used_ += consumed;
+  frame_sizes_[current_frame_] += consumed;
+  head_ = offset + size == capacity_ ? 0 : offset + size;
+  return offset;
+}
+} // namespace cg
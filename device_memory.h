@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+namespace cg {
+struct MemoryBlock;
+
+// A range of device memory handed out by DeviceAllocator.
+struct Allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // Host pointer to offset for host-visible memory, otherwise nullptr.
+  void *mapped = nullptr;
+  uint32_t memory_type = 0;
+  // Owning block, or nullptr for a dedicated VkDeviceMemory.
+  MemoryBlock *block = nullptr;
+};
+
+struct AllocatorStatistics {
+  uint32_t block_count = 0;
+  uint32_t dedicated_count = 0;
+  uint32_t allocation_count = 0;
+  VkDeviceSize bytes_reserved = 0;
+  VkDeviceSize bytes_used = 0;
+  VkDeviceSize largest_free_range = 0;
+  // 1 - largest free range / free bytes across blocks: 0 when all free space
+  // is contiguous, approaching 1 as it splinters.
+  double fragmentation = 0.0;
+};
+
+// Long-lived device memory. Allocates large blocks per memory type and
+// sub-allocates them best-fit from a coalescing free list, so resource count
+// is not bounded by maxMemoryAllocationCount. Host-visible blocks stay
+// persistently mapped. Thread-safe.
+class DeviceAllocator {
+public:
+  static constexpr VkDeviceSize kDefaultBlockSize = 64ull << 20;
+
+  DeviceAllocator(const VkPhysicalDevice &physical_device,
+                  const VkDevice &device,
+                  VkDeviceSize block_size = kDefaultBlockSize);
+  ~DeviceAllocator();
+
+  DeviceAllocator(const DeviceAllocator &) = delete;
+  DeviceAllocator &operator=(const DeviceAllocator &) = delete;
+
+  // Picks a memory type with all required flags, favoring one that also has
+  // the preferred flags. linear is false for optimal-tiling images, whose
+  // ranges are padded to bufferImageGranularity so they never share a page
+  // with a buffer or linear image.
+  Allocation allocate(const VkMemoryRequirements &requirements,
+                      VkMemoryPropertyFlags required,
+                      VkMemoryPropertyFlags preferred = 0, bool linear = true);
+  // Allocates and binds memory for the resource.
+  Allocation allocateForBuffer(const VkBuffer &buffer,
+                               VkMemoryPropertyFlags required,
+                               VkMemoryPropertyFlags preferred = 0);
+  Allocation allocateForImage(const VkImage &image,
+                              VkMemoryPropertyFlags required,
+                              VkMemoryPropertyFlags preferred = 0);
+  void free(const Allocation &allocation);
+
+  // Flushes a non-coherent host write; a no-op for coherent memory.
+  void flush(const Allocation &allocation) const;
+
+  AllocatorStatistics statistics() const;
+  const VkDevice &device() const { return device_; }
+  VkMemoryPropertyFlags memoryTypeFlags(uint32_t memory_type) const {
+    return memory_properties_.memoryTypes[memory_type].propertyFlags;
+  }
+
+private:
+  std::optional<uint32_t> findMemoryType(uint32_t type_bits,
+                                         VkMemoryPropertyFlags flags) const;
+  Allocation allocateDedicated(VkDeviceSize size, uint32_t memory_type);
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memory_type,
+                                void **mapped);
+
+  VkDevice device_;
+  VkPhysicalDeviceMemoryProperties memory_properties_;
+  VkDeviceSize block_size_;
+  VkDeviceSize buffer_image_granularity_;
+  VkDeviceSize non_coherent_atom_size_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::vector<std::unique_ptr<MemoryBlock>>> blocks_;
+  uint32_t dedicated_count_ = 0;
+  VkDeviceSize dedicated_bytes_ = 0;
+};
+
+// Bump allocator over one allocation for data that lives until the next
+// reset(), e.g. scratch data of a single upload.
+class LinearAllocator {
+public:
+  explicit LinearAllocator(VkDeviceSize capacity) : capacity_(capacity) {}
+
+  // Offset of size bytes within the parent range, or nothing when full.
+  std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                       VkDeviceSize alignment);
+  void reset() { head_ = 0; }
+  VkDeviceSize used() const { return head_; }
+
+private:
+  VkDeviceSize capacity_;
+  VkDeviceSize head_ = 0;
+};
+
+// Ring allocator over one allocation for per-frame transient data. Space
+// used by a frame is reclaimed when the same frame slot begins again, i.e.
+// after the caller has waited on that slot's fence.
+class RingAllocator {
+public:
+  RingAllocator(VkDeviceSize capacity, uint32_t frame_count);
+
+  void beginFrame(uint32_t frame_index);
+  // Offset of size bytes within the parent range, or nothing when the ring
+  // would overrun data still in flight. Any size up to capacity() succeeds
+  // once every frame slot has been released.
+  std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                       VkDeviceSize alignment);
+  VkDeviceSize capacity() const { return capacity_; }
+  // Whether no frame slot holds any of the ring.
+  bool empty() const { return used_ == 0; }
+
+private:
+  VkDeviceSize capacity_;
+  VkDeviceSize head_ = 0;
+  VkDeviceSize used_ = 0;
+  // Bytes, including alignment and wrap-around padding, consumed by each
+  // frame slot's most recent use. Slots retire in ring order, so releasing
+  // them advances the tail implicitly.
+  std::vector<VkDeviceSize> frame_sizes_;
+  uint32_t current_frame_ = 0;
+};
+} // namespace cg
@@ -0,0 +1,240 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#include "shader/shader_utils.h"
+
+namespace cg {
+namespace {
+constexpr uint32_t kWorkgroupSize = 64;
+constexpr uint32_t kBindingCount = 4;
+
+// Matches the push constant block of cull.comp.
+struct CullPushConstants {
+  FrameUniforms frame;
+  uint32_t batch;
+  uint32_t mesh;
+  uint32_t first_instance;
+  uint32_t instance_count;
+};
+
+// Matches the MeshBounds element of cull.comp.
+struct BoundsData {
+  float center[2];
+  float radius;
+  float padding;
+};
+
+VkDescriptorSetLayout createSetLayout(const VkDevice &device) {
+  std::array<VkDescriptorSetLayoutBinding, kBindingCount> bindings{};
+  for (uint32_t i = 0; i < kBindingCount; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  info.bindingCount = kBindingCount;
+  info.pBindings = bindings.data();
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(device, &info, nullptr, &layout) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor set layout!");
+  }
+  return layout;
+}
+
+VkPipelineLayout createCullPipelineLayout(const VkDescriptorSetLayout &set,
+                                          const VkDevice &device) {
+  VkPushConstantRange range{};
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  range.offset = 0;
+  range.size = sizeof(CullPushConstants);
+  VkPipelineLayoutCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  info.setLayoutCount = 1;
+  info.pSetLayouts = &set;
+  info.pushConstantRangeCount = 1;
+  info.pPushConstantRanges = &range;
+  VkPipelineLayout layout;
+  if (vkCreatePipelineLayout(device, &info, nullptr, &layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline layout!");
+  }
+  return layout;
+}
+
+VkPipeline createCullPipeline(const VkPipelineLayout &layout,
+                              const VkPipelineCache &cache,
+                              const VkDevice &device) {
+  const VkShaderModule module = createShaderModule("cull.comp", device);
+  VkComputePipelineCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  info.stage.module = module;
+  info.stage.pName = "main";
+  info.layout = layout;
+  VkPipeline pipeline;
+  const VkResult result =
+      vkCreateComputePipelines(device, cache, 1, &info, nullptr, &pipeline);
+  vkDestroyShaderModule(device, module, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create compute pipeline!");
+  }
+  return pipeline;
+}
+
+VkDescriptorPool createDescriptorPool(uint32_t set_count,
+                                      const VkDevice &device) {
+  VkDescriptorPoolSize size{};
+  size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  size.descriptorCount = set_count * kBindingCount;
+  VkDescriptorPoolCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  info.maxSets = set_count;
+  info.poolSizeCount = 1;
+  info.pPoolSizes = &size;
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(device, &info, nullptr, &pool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor pool!");
+  }
+  return pool;
+}
+
+// Replaces buffer with a larger one if it holds less than size bytes.
+void reserve(DeviceAllocator &allocator, Buffer &buffer, VkDeviceSize size,
+             VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+             VkMemoryPropertyFlags preferred = 0) {
+  if (buffer.size >= size) {
+    return;
+  }
+  buffer.destroy(allocator);
+  buffer = createBuffer(allocator, std::max(size, buffer.size * 2), usage,
+                        required, preferred);
+}
+} // namespace
+
+GpuCuller::GpuCuller(const VkDevice &device, const VkPipelineCache &cache,
+                     uint32_t frame_count)
+    : device_(device), frames_(frame_count) {
+  set_layout_ = createSetLayout(device_);
+  layout_ = createCullPipelineLayout(set_layout_, device_);
+  pipeline_ = createCullPipeline(layout_, cache, device_);
+  descriptor_pool_ = createDescriptorPool(frame_count, device_);
+
+  const std::vector<VkDescriptorSetLayout> layouts(frame_count, set_layout_);
+  std::vector<VkDescriptorSet> sets(frame_count);
+  VkDescriptorSetAllocateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  info.descriptorPool = descriptor_pool_;
+  info.descriptorSetCount = frame_count;
+  info.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(device_, &info, sets.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate descriptor sets!");
+  }
+  for (uint32_t i = 0; i < frame_count; ++i) {
+    frames_[i].descriptor_set = sets[i];
+  }
+}
+
+void GpuCuller::destroy(DeviceAllocator &allocator) {
+  for (auto &frame : frames_) {
+    frame.visible.destroy(allocator);
+    frame.commands.destroy(allocator);
+  }
+  bounds_.destroy(allocator);
+  vkDestroyDescriptorPool(device_, descriptor_pool_, nullptr);
+  vkDestroyPipeline(device_, pipeline_, nullptr);
+  vkDestroyPipelineLayout(device_, layout_, nullptr);
+  vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+}
+
+void GpuCuller::setBounds(DeviceAllocator &allocator,
+                          const std::vector<Mesh> &meshes) {
+  std::vector<BoundsData> bounds(std::max<size_t>(meshes.size(), 1));
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    bounds[i] = {{meshes[i].bounds.center[0], meshes[i].bounds.center[1]},
+                 meshes[i].bounds.radius,
+                 0.0f};
+  }
+  const VkDeviceSize size = bounds.size() * sizeof(BoundsData);
+  reserve(allocator, bounds_, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  std::memcpy(bounds_.allocation.mapped, bounds.data(), size);
+  allocator.flush(bounds_.allocation);
+}
+
+void GpuCuller::cull(VkCommandBuffer command_buffer,
+                     DeviceAllocator &allocator, uint32_t frame_index,
+                     const DrawBatcher &batcher,
+                     const std::vector<Mesh> &meshes,
+                     const VkBuffer &instance_buffer,
+                     const FrameUniforms &frame_uniforms) {
+  const auto &batches = batcher.batches();
+  if (batches.empty()) {
+    return;
+  }
+  FrameResources &frame = frames_[frame_index];
+  reserve(allocator, frame.visible,
+          batcher.instances().size() * sizeof(InstanceData),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  const VkDeviceSize commands_size =
+      batches.size() * sizeof(VkDrawIndexedIndirectCommand);
+  reserve(allocator, frame.commands, commands_size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  // The shader only counts instances; everything else is filled in here.
+  auto *commands = static_cast<VkDrawIndexedIndirectCommand *>(
+      frame.commands.allocation.mapped);
+  for (size_t i = 0; i < batches.size(); ++i) {
+    commands[i].indexCount = meshes[batches[i].mesh].index_count;
+    commands[i].instanceCount = 0;
+    commands[i].firstIndex = 0;
+    commands[i].vertexOffset = 0;
+    commands[i].firstInstance = 0;
+  }
+  allocator.flush(frame.commands.allocation);
+
+  const std::array<VkDescriptorBufferInfo, kBindingCount> buffer_infos = {{
+      {instance_buffer, 0, VK_WHOLE_SIZE},
+      {frame.visible.buffer, 0, VK_WHOLE_SIZE},
+      {frame.commands.buffer, 0, VK_WHOLE_SIZE},
+      {bounds_.buffer, 0, VK_WHOLE_SIZE},
+  }};
+  std::array<VkWriteDescriptorSet, kBindingCount> writes{};
+  for (uint32_t i = 0; i < kBindingCount; ++i) {
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = frame.descriptor_set;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &buffer_infos[i];
+  }
+  vkUpdateDescriptorSets(device_, kBindingCount, writes.data(), 0, nullptr);
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          layout_, 0, 1, &frame.descriptor_set, 0, nullptr);
+  for (uint32_t i = 0; i < batches.size(); ++i) {
+    const CullPushConstants constants{frame_uniforms, i, batches[i].mesh,
+                                      batches[i].first_instance,
+                                      batches[i].instance_count};
+    vkCmdPushConstants(command_buffer, layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(constants), &constants);
+    vkCmdDispatch(command_buffer,
+                  (batches[i].instance_count + kWorkgroupSize - 1) /
+                      kWorkgroupSize,
+                  1, 1);
+  }
+}
+} // namespace cg
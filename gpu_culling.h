@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+#include "instancing.h"
+#include "mesh.h"
+
+namespace cg {
+// Frustum-culls the instances of built DrawBatcher batches in a compute pass
+// and compacts the survivors, so the batches can be drawn with
+// DrawBatcher::recordIndirect(). Buffers are per frame slot and are only
+// rewritten after the caller has waited on the slot's fence.
+class GpuCuller {
+public:
+  GpuCuller(const VkDevice &device, const VkPipelineCache &cache,
+            uint32_t frame_count);
+
+  void destroy(DeviceAllocator &allocator);
+
+  // Uploads the bounding circles of meshes, indexed like Batch::mesh.
+  void setBounds(DeviceAllocator &allocator, const std::vector<Mesh> &meshes);
+
+  // Records the culling dispatches for batcher's batches, reading the
+  // instances from instance_buffer and culling against the view of
+  // frame_uniforms. Record outside of a render pass; the caller makes the
+  // compute shader writes visible to the indirect draws and vertex input.
+  void cull(VkCommandBuffer command_buffer, DeviceAllocator &allocator,
+            uint32_t frame_index, const DrawBatcher &batcher,
+            const std::vector<Mesh> &meshes, const VkBuffer &instance_buffer,
+            const FrameUniforms &frame_uniforms);
+
+  const VkBuffer &visibleBuffer(uint32_t frame_index) const {
+    return frames_[frame_index].visible.buffer;
+  }
+  const VkBuffer &indirectBuffer(uint32_t frame_index) const {
+    return frames_[frame_index].commands.buffer;
+  }
+
+private:
+  struct FrameResources {
+    // Surviving instances, compacted within each batch's range.
+    Buffer visible;
+    // One VkDrawIndexedIndirectCommand per batch.
+    Buffer commands;
+    VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+  };
+
+  VkDevice device_;
+  VkDescriptorSetLayout set_layout_;
+  VkPipelineLayout layout_;
+  VkPipeline pipeline_;
+  VkDescriptorPool descriptor_pool_;
+  Buffer bounds_;
+  std::vector<FrameResources> frames_;
+};
+} // namespace cg
@@ -0,0 +1,178 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+constexpr uint32_t kQueriesPerFrame = 2 * GpuProfiler::kMaxScopesPerFrame;
+
+struct QueryResult {
+  uint64_t value;
+  uint64_t available;
+};
+} // namespace
+
+GpuProfiler::GpuProfiler(const VkDevice &device, uint32_t frame_count,
+                         uint32_t timestamp_valid_bits,
+                         float timestamp_period)
+    : timestamp_period_(timestamp_period) {
+  if (timestamp_valid_bits == 0) {
+    return;
+  }
+  timestamp_mask_ = timestamp_valid_bits >= 64
+                        ? UINT64_MAX
+                        : (uint64_t{1} << timestamp_valid_bits) - 1;
+  frames_.resize(frame_count);
+  for (auto &frame : frames_) {
+    VkQueryPoolCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = kQueriesPerFrame;
+    if (vkCreateQueryPool(device, &info, nullptr, &frame.pool) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create query pool!");
+    }
+  }
+}
+
+void GpuProfiler::destroy(const VkDevice &device) {
+  for (auto &frame : frames_) {
+    vkDestroyQueryPool(device, frame.pool, nullptr);
+  }
+  frames_.clear();
+}
+
+bool GpuProfiler::collect(const VkDevice &device, uint32_t frame_index) {
+  if (!enabled()) {
+    return false;
+  }
+  FrameQueries &frame = frames_[frame_index];
+  if (!frame.pending || frame.names.empty()) {
+    return false;
+  }
+  frame.pending = false;
+
+  const uint32_t query_count = 2 * static_cast<uint32_t>(frame.names.size());
+  std::vector<QueryResult> results(query_count);
+  const VkResult status = vkGetQueryPoolResults(
+      device, frame.pool, 0, query_count, results.size() * sizeof(QueryResult),
+      results.data(), sizeof(QueryResult),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (status != VK_SUCCESS && status != VK_NOT_READY) {
+    return false;
+  }
+
+  last_results_.clear();
+  // Ticks do not wrap within a frame in practice, so the earliest and latest
+  // raw values bound the frame.
+  std::optional<uint64_t> frame_begin, frame_end;
+  for (size_t i = 0; i < frame.names.size(); ++i) {
+    const QueryResult &begin = results[2 * i];
+    const QueryResult &end = results[2 * i + 1];
+    if (!begin.available || !end.available) {
+      continue;
+    }
+    const double ms = toMilliseconds(begin.value, end.value);
+    last_results_.push_back({frame.names[i], ms});
+    Accumulator &accumulator = accumulators_[frame.names[i]];
+    accumulator.total_ms += ms;
+    ++accumulator.count;
+    frame_begin = std::min(frame_begin.value_or(UINT64_MAX), begin.value);
+    frame_end = std::max(frame_end.value_or(0), end.value);
+  }
+  if (!frame_begin.has_value()) {
+    return false;
+  }
+  last_idle_ms_.reset();
+  if (last_frame_end_.has_value()) {
+    const uint64_t gap = (frame_begin.value() - last_frame_end_.value()) &
+                         timestamp_mask_;
+    // Queues may overlap consecutive frames; a "negative" gap is no idle.
+    const double idle_ms =
+        gap > (timestamp_mask_ >> 1) ? 0.0 : toMilliseconds(0, gap);
+    last_idle_ms_ = idle_ms;
+    idle_accumulator_.total_ms += idle_ms;
+    ++idle_accumulator_.count;
+  }
+  last_frame_end_ = frame_end;
+  ++resolved_frames_;
+  return true;
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer command_buffer,
+                             uint32_t frame_index) {
+  if (!enabled()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  recording_frame_ = frame_index;
+  FrameQueries &frame = frames_[frame_index];
+  frame.names.clear();
+  frame.pending = true;
+  vkCmdResetQueryPool(command_buffer, frame.pool, 0, kQueriesPerFrame);
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer command_buffer,
+                                 const char *name,
+                                 VkPipelineStageFlagBits stage) {
+  if (!enabled()) {
+    return kInvalidScope;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  FrameQueries &frame = frames_[recording_frame_];
+  if (frame.names.size() >= kMaxScopesPerFrame) {
+    return kInvalidScope;
+  }
+  const uint32_t scope = static_cast<uint32_t>(frame.names.size());
+  frame.names.emplace_back(name);
+  vkCmdWriteTimestamp(command_buffer, stage, frame.pool, 2 * scope);
+  return scope;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer command_buffer, uint32_t scope,
+                           VkPipelineStageFlagBits stage) {
+  if (scope == kInvalidScope) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  vkCmdWriteTimestamp(command_buffer, stage, frames_[recording_frame_].pool,
+                      2 * scope + 1);
+}
+
+std::optional<double>
+GpuProfiler::lastScopeMilliseconds(const std::string &name) const {
+  for (const auto &timing : last_results_) {
+    if (timing.name == name) {
+      return timing.milliseconds;
+    }
+  }
+  return std::nullopt;
+}
+
+void GpuProfiler::logSummary(std::ostream &out) {
+  if (resolved_frames_ == 0) {
+    return;
+  }
+  out << "gpu (avg over " << resolved_frames_ << " frames):" << std::fixed
+      << std::setprecision(3);
+  for (const auto &[name, accumulator] : accumulators_) {
+    out << ' ' << name << ' ' << accumulator.total_ms / accumulator.count
+        << "ms";
+  }
+  if (idle_accumulator_.count > 0) {
+    out << " idle " << idle_accumulator_.total_ms / idle_accumulator_.count
+        << "ms";
+  }
+  out << std::endl;
+  accumulators_.clear();
+  idle_accumulator_ = {};
+  resolved_frames_ = 0;
+}
+
+double GpuProfiler::toMilliseconds(uint64_t begin, uint64_t end) const {
+  const uint64_t ticks = (end - begin) & timestamp_mask_;
+  return ticks * static_cast<double>(timestamp_period_) / 1e6;
+}
+} // namespace cg
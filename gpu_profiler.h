@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+namespace cg {
+struct GpuScopeTiming {
+  std::string name;
+  double milliseconds;
+};
+
+// Timestamp queries ring-buffered per frame slot. A slot's queries are only
+// read back after the caller has waited on that slot's fence, so readback
+// never blocks on the GPU.
+class GpuProfiler {
+public:
+  static constexpr uint32_t kInvalidScope = UINT32_MAX;
+  static constexpr uint32_t kMaxScopesPerFrame = 64;
+
+  // Profiling is disabled when timestamp_valid_bits is zero.
+  GpuProfiler(const VkDevice &device, uint32_t frame_count,
+              uint32_t timestamp_valid_bits, float timestamp_period);
+
+  void destroy(const VkDevice &device);
+
+  bool enabled() const { return !frames_.empty(); }
+
+  // Resolves the previous use of the slot and returns whether it produced
+  // results. Must be called after the slot's fence has signaled.
+  bool collect(const VkDevice &device, uint32_t frame_index);
+  // Resets the slot's queries; record before any scope of the frame.
+  void beginFrame(VkCommandBuffer command_buffer, uint32_t frame_index);
+
+  // May be recorded into any command buffer submitted for the frame, from any
+  // thread. Returns kInvalidScope when disabled or out of queries.
+  uint32_t beginScope(VkCommandBuffer command_buffer, const char *name,
+                      VkPipelineStageFlagBits stage =
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  void endScope(VkCommandBuffer command_buffer, uint32_t scope,
+                VkPipelineStageFlagBits stage =
+                    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+  // Scopes of the most recently resolved frame, in recording order.
+  const std::vector<GpuScopeTiming> &lastResults() const {
+    return last_results_;
+  }
+  std::optional<double> lastScopeMilliseconds(const std::string &name) const;
+  // Gap between the end of the previously resolved frame and the start of
+  // the last one, i.e. time the GPU spent waiting for work.
+  std::optional<double> lastIdleMilliseconds() const { return last_idle_ms_; }
+
+  // Writes one line with per-scope averages since the previous call.
+  void logSummary(std::ostream &out);
+
+private:
+  struct FrameQueries {
+    VkQueryPool pool = VK_NULL_HANDLE;
+    std::vector<std::string> names;
+    bool pending = false;
+  };
+
+  double toMilliseconds(uint64_t begin, uint64_t end) const;
+
+  std::vector<FrameQueries> frames_;
+  uint32_t recording_frame_ = 0;
+  std::mutex mutex_;
+  uint64_t timestamp_mask_ = 0;
+  float timestamp_period_ = 0.0f;
+
+  std::vector<GpuScopeTiming> last_results_;
+  std::optional<double> last_idle_ms_;
+  std::optional<uint64_t> last_frame_end_;
+
+  struct Accumulator {
+    double total_ms = 0.0;
+    uint32_t count = 0;
+  };
+  std::map<std::string, Accumulator> accumulators_;
+  Accumulator idle_accumulator_;
+  uint32_t resolved_frames_ = 0;
+};
+
+// Records a GpuProfiler scope for the lifetime of the object.
+class GpuScope {
+public:
+  GpuScope(GpuProfiler &profiler, VkCommandBuffer command_buffer,
+           const char *name)
+      : profiler_(profiler), command_buffer_(command_buffer),
+        scope_(profiler.beginScope(command_buffer, name)) {}
+  ~GpuScope() { profiler_.endScope(command_buffer_, scope_); }
+
+  GpuScope(const GpuScope &) = delete;
+  GpuScope &operator=(const GpuScope &) = delete;
+
+private:
+  GpuProfiler &profiler_;
+  VkCommandBuffer command_buffer_;
+  uint32_t scope_;
+};
+} // namespace cg
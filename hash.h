@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace cg {
+// Mixes the hash of value into seed, as boost::hash_combine does.
+template <typename T> void hashCombine(size_t &seed, const T &value) {
+  seed ^= std::hash<T>()(value) + 0x9e3779b97f4a7c15ull + (seed << 6) +
+          (seed >> 2);
+}
+} // namespace cg
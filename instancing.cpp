@@ -0,0 +1,240 @@
+#include "instancing.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cg {
+namespace {
+constexpr VkDeviceSize kMinInstanceCapacity = 256;
+// Fewer instances are built on the calling thread, as jobs would cost more
+// than they save.
+constexpr size_t kParallelInstanceCount = 16384;
+} // namespace
+
+const std::vector<VkFormat> &getInstanceFormats() {
+  static const std::vector<VkFormat> formats = {
+      VK_FORMAT_R32G32B32A32_SFLOAT,
+      VK_FORMAT_R32G32_SFLOAT,
+      VK_FORMAT_R8G8B8A8_UNORM,
+      VK_FORMAT_R32_UINT,
+      VK_FORMAT_R32_SFLOAT,
+  };
+  return formats;
+}
+
+void DrawBatcher::clear() {
+  for (auto &[key, instances] : groups_) {
+    instances.clear();
+  }
+  batches_.clear();
+  instances_.clear();
+}
+
+void DrawBatcher::add(VkPipeline pipeline, uint32_t mesh,
+                      const InstanceData &instance) {
+  const Key key{pipeline, mesh};
+  if (last_group_ == nullptr || key != last_key_) {
+    last_group_ = &groups_[key];
+    last_key_ = key;
+  }
+  last_group_->push_back(instance);
+}
+
+void DrawBatcher::build(JobSystem *jobs) {
+  batches_.clear();
+  sorted_groups_.clear();
+  size_t instance_count = 0;
+  for (auto &[key, instances] : groups_) {
+    if (instances.empty()) {
+      continue;
+    }
+    uint32_t rank = 0;
+    if (!sorted_groups_.empty()) {
+      const SortedGroup &previous = sorted_groups_.back();
+      rank = previous.pipeline_rank + (previous.pipeline != key.first ? 1 : 0);
+    }
+    sorted_groups_.push_back({rank, 0.0f, key.first, key.second, &instances});
+    instance_count += instances.size();
+  }
+  // Calls body over ranges of [0, count), a few per thread, and not at all
+  // for an empty range, e.g. when everything was culled.
+  const auto split = [&](uint32_t count, const auto &body) {
+    if (count == 0) {
+      return;
+    }
+    if (jobs == nullptr || instance_count < kParallelInstanceCount) {
+      body(0, count);
+      return;
+    }
+    jobs->parallelFor(count, count / (4 * jobs->concurrency()), body);
+  };
+
+  const auto nearer = [](const InstanceData &a, const InstanceData &b) {
+    return a.depth < b.depth;
+  };
+  split(static_cast<uint32_t>(sorted_groups_.size()),
+        [&](uint32_t begin, uint32_t end) {
+          for (uint32_t i = begin; i < end; ++i) {
+            auto &instances = *sorted_groups_[i].instances;
+            // Instances are usually added in depth order already.
+            if (!std::is_sorted(instances.begin(), instances.end(), nearer)) {
+              std::stable_sort(instances.begin(), instances.end(), nearer);
+            }
+            sorted_groups_[i].nearest_depth = instances.front().depth;
+          }
+        });
+  std::sort(sorted_groups_.begin(), sorted_groups_.end(),
+            [](const SortedGroup &a, const SortedGroup &b) {
+              if (a.pipeline_rank != b.pipeline_rank) {
+                return a.pipeline_rank < b.pipeline_rank;
+              }
+              if (a.nearest_depth != b.nearest_depth) {
+                return a.nearest_depth < b.nearest_depth;
+              }
+              return a.mesh < b.mesh;
+            });
+  uint32_t first_instance = 0;
+  for (const auto &group : sorted_groups_) {
+    const uint32_t count = static_cast<uint32_t>(group.instances->size());
+    batches_.push_back({
+        .pipeline = group.pipeline,
+        .mesh = group.mesh,
+        .first_instance = first_instance,
+        .instance_count = count,
+    });
+    first_instance += count;
+  }
+  instances_.resize(instance_count);
+  // Split by instance rather than by group, so that one large group is
+  // copied by several jobs.
+  split(static_cast<uint32_t>(instance_count),
+        [&](uint32_t begin, uint32_t end) {
+          // The last batch starting at or before begin.
+          auto batch = std::upper_bound(
+                           batches_.begin(), batches_.end(), begin,
+                           [](uint32_t instance, const Batch &batch) {
+                             return instance < batch.first_instance;
+                           }) -
+                       1;
+          while (begin < end) {
+            const auto &source =
+                *sorted_groups_[batch - batches_.begin()].instances;
+            const uint32_t batch_end =
+                std::min(end, batch->first_instance + batch->instance_count);
+            std::copy(source.begin() + (begin - batch->first_instance),
+                      source.begin() + (batch_end - batch->first_instance),
+                      instances_.begin() + begin);
+            begin = batch_end;
+            ++batch;
+          }
+        });
+}
+
+void DrawBatcher::bindBatch(VkCommandBuffer command_buffer,
+                            const VkPipelineLayout &layout,
+                            const std::vector<Mesh> &meshes, uint32_t batch,
+                            const std::vector<VkPipeline> *pipelines,
+                            VkPipeline &bound_pipeline,
+                            const Mesh *&bound_mesh) const {
+  const Batch &info = batches_[batch];
+  const VkPipeline pipeline = pipelines ? (*pipelines)[batch] : info.pipeline;
+  if (pipeline != bound_pipeline) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    bound_pipeline = pipeline;
+  }
+  const Mesh &mesh = meshes[info.mesh];
+  if (&mesh != bound_mesh) {
+    mesh.bind(command_buffer);
+    bound_mesh = &mesh;
+  }
+  const DrawConstants constants{info.mesh, batch};
+  vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                     sizeof(constants), &constants);
+}
+
+void DrawBatcher::record(VkCommandBuffer command_buffer,
+                         const VkPipelineLayout &layout,
+                         const std::vector<Mesh> &meshes,
+                         const VkBuffer &instance_buffer,
+                         uint32_t instance_binding, uint32_t first_batch,
+                         uint32_t batch_count,
+                         const std::vector<VkPipeline> *pipelines) const {
+  const size_t end =
+      std::min<size_t>(batches_.size(), size_t{first_batch} + batch_count);
+  if (first_batch >= end) {
+    return;
+  }
+  const VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(command_buffer, instance_binding, 1,
+                         &instance_buffer, &offset);
+  VkPipeline bound_pipeline = VK_NULL_HANDLE;
+  const Mesh *bound_mesh = nullptr;
+  for (size_t i = first_batch; i < end; ++i) {
+    bindBatch(command_buffer, layout, meshes, static_cast<uint32_t>(i),
+              pipelines, bound_pipeline, bound_mesh);
+    const Batch &batch = batches_[i];
+    bound_mesh->draw(command_buffer, batch.instance_count,
+                     batch.first_instance);
+  }
+}
+
+void DrawBatcher::recordIndirect(VkCommandBuffer command_buffer,
+                                 const VkPipelineLayout &layout,
+                                 const std::vector<Mesh> &meshes,
+                                 const VkBuffer &visible_buffer,
+                                 uint32_t instance_binding,
+                                 const VkBuffer &indirect_buffer,
+                                 uint32_t first_batch,
+                                 uint32_t batch_count,
+                                 const std::vector<VkPipeline> *pipelines)
+    const {
+  const size_t end =
+      std::min<size_t>(batches_.size(), size_t{first_batch} + batch_count);
+  VkPipeline bound_pipeline = VK_NULL_HANDLE;
+  const Mesh *bound_mesh = nullptr;
+  for (size_t i = first_batch; i < end; ++i) {
+    bindBatch(command_buffer, layout, meshes, static_cast<uint32_t>(i),
+              pipelines, bound_pipeline, bound_mesh);
+    const Batch &batch = batches_[i];
+    // Offsetting the binding instead of setting firstInstance in the command
+    // avoids depending on the drawIndirectFirstInstance feature.
+    const VkDeviceSize offset = VkDeviceSize{batch.first_instance} *
+                                sizeof(InstanceData);
+    vkCmdBindVertexBuffers(command_buffer, instance_binding, 1,
+                           &visible_buffer, &offset);
+    bound_mesh->drawIndirect(command_buffer, indirect_buffer,
+                             i * sizeof(VkDrawIndexedIndirectCommand));
+  }
+}
+
+void InstanceStream::upload(DeviceAllocator &allocator, uint32_t frame_index,
+                            const std::vector<InstanceData> &instances) {
+  const VkDeviceSize size = instances.size() * sizeof(InstanceData);
+  if (size == 0) {
+    return;
+  }
+  Buffer &buffer = buffers_[frame_index];
+  if (buffer.size < size) {
+    buffer.destroy(allocator);
+    const VkDeviceSize capacity =
+        std::max({size, buffer.size * 2,
+                  kMinInstanceCapacity * sizeof(InstanceData)});
+    // Device-local host-visible memory, where available, spares the vertex
+    // fetch a trip over the bus.
+    buffer = createBuffer(allocator, capacity,
+                          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  }
+  std::memcpy(buffer.allocation.mapped, instances.data(), size);
+  allocator.flush(buffer.allocation);
+}
+
+void InstanceStream::destroy(DeviceAllocator &allocator) {
+  for (auto &buffer : buffers_) {
+    buffer.destroy(allocator);
+  }
+}
+} // namespace cg
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+#include "job_system.h"
+#include "mesh.h"
+
+namespace cg {
+// Per-instance vertex attributes: a column-major 2x2 transform, a
+// translation, an RGBA8 tint that multiplies the vertex color, for bindless
+// rendering the index of the instance's material, and the instance's depth
+// in [0, 1], smaller depths being in front.
+struct InstanceData {
+  float transform[4];
+  float translation[2];
+  uint32_t tint;
+  uint32_t material;
+  float depth;
+};
+
+// Per-frame view transform of the vertex shader's set 0, binding 0 uniform
+// block: clip position = view * world position + view_translation.
+struct FrameUniforms {
+  float view[4];
+  float view_translation[2];
+};
+
+// Per-draw push constants of the vertex stage.
+struct DrawConstants {
+  uint32_t mesh;
+  uint32_t batch;
+};
+
+// Attribute formats of InstanceData, for a binding with
+// VK_VERTEX_INPUT_RATE_INSTANCE.
+const std::vector<VkFormat> &getInstanceFormats();
+
+// Groups instances by pipeline and mesh so that every group becomes a single
+// instanced draw. Storage is kept across clear() so steady-state frames do
+// not allocate.
+class DrawBatcher {
+public:
+  struct Batch {
+    VkPipeline pipeline;
+    uint32_t mesh;
+    uint32_t first_instance;
+    uint32_t instance_count;
+  };
+
+  void clear();
+  void add(VkPipeline pipeline, uint32_t mesh, const InstanceData &instance);
+
+  // Orders the groups by pipeline, then nearest instance, and lays out their
+  // instances back to back in instances(), each group's front to back, so
+  // that opaque draws reject hidden fragments before shading them. Large
+  // scenes sort and copy their groups in parallel on jobs, if given.
+  void build(JobSystem *jobs = nullptr);
+
+  const std::vector<Batch> &batches() const { return batches_; }
+  const std::vector<InstanceData> &instances() const { return instances_; }
+
+  // Records one vkCmdDrawIndexed per batch in [first_batch, first_batch +
+  // batch_count), rebinding the pipeline and mesh only when they change and
+  // pushing each batch's DrawConstants through layout. Mesh streams bind
+  // from binding 0 and the built instances are expected in instance_buffer
+  // at instance_binding. Disjoint ranges may be recorded into different
+  // command buffers concurrently. pipelines, if given, holds one pipeline
+  // per batch to draw with instead of its own, e.g. for a depth prepass.
+  void record(VkCommandBuffer command_buffer, const VkPipelineLayout &layout,
+              const std::vector<Mesh> &meshes,
+              const VkBuffer &instance_buffer, uint32_t instance_binding,
+              uint32_t first_batch = 0, uint32_t batch_count = UINT32_MAX,
+              const std::vector<VkPipeline> *pipelines = nullptr) const;
+  // Like record(), but each batch draws with the instance count GPU culling
+  // wrote into its VkDrawIndexedIndirectCommand in indirect_buffer, from
+  // the surviving instances compacted into its range of visible_buffer.
+  // Compaction does not keep the front-to-back order within a batch.
+  void recordIndirect(VkCommandBuffer command_buffer,
+                      const VkPipelineLayout &layout,
+                      const std::vector<Mesh> &meshes,
+                      const VkBuffer &visible_buffer, uint32_t instance_binding,
+                      const VkBuffer &indirect_buffer, uint32_t first_batch = 0,
+                      uint32_t batch_count = UINT32_MAX,
+                      const std::vector<VkPipeline> *pipelines = nullptr) const;
+
+private:
+  // Binds the batch's pipeline, or its entry of pipelines, and mesh unless
+  // already bound and pushes its DrawConstants.
+  void bindBatch(VkCommandBuffer command_buffer, const VkPipelineLayout &layout,
+                 const std::vector<Mesh> &meshes, uint32_t batch,
+                 const std::vector<VkPipeline> *pipelines,
+                 VkPipeline &bound_pipeline, const Mesh *&bound_mesh) const;
+
+  using Key = std::pair<VkPipeline, uint32_t>;
+
+  std::map<Key, std::vector<InstanceData>> groups_;
+  // Group of the previous add(), which is usually the next one's as well.
+  std::vector<InstanceData> *last_group_ = nullptr;
+  Key last_key_{VK_NULL_HANDLE, 0};
+
+  struct SortedGroup {
+    // Position of the pipeline in groups_, which keeps its groups adjacent.
+    uint32_t pipeline_rank;
+    float nearest_depth;
+    VkPipeline pipeline;
+    uint32_t mesh;
+    std::vector<InstanceData> *instances;
+  };
+  std::vector<SortedGroup> sorted_groups_;
+
+  std::vector<Batch> batches_;
+  std::vector<InstanceData> instances_;
+};
+
+// Host-visible instance buffers, one per frame slot, grown on demand. A
+// slot's buffer is only rewritten after the caller has waited on its fence.
+// The buffers are also bindable as storage buffers for GPU culling.
+class InstanceStream {
+public:
+  InstanceStream() = default;
+  explicit InstanceStream(uint32_t frame_count) : buffers_(frame_count) {}
+
+  void upload(DeviceAllocator &allocator, uint32_t frame_index,
+              const std::vector<InstanceData> &instances);
+  const VkBuffer &buffer(uint32_t frame_index) const {
+    return buffers_[frame_index].buffer;
+  }
+
+  void destroy(DeviceAllocator &allocator);
+
+private:
+  std::vector<Buffer> buffers_;
+};
+} // namespace cg
@@ -0,0 +1,187 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+namespace cg {
+namespace {
+// The system the calling thread works for, if any, and its queue there.
+thread_local const JobSystem *current_system = nullptr;
+thread_local uint32_t current_queue = 0;
+} // namespace
+
+FrameArena::FrameArena(size_t capacity, uint32_t frame_count)
+    : capacity_(capacity), regions_(frame_count) {
+  for (auto &region : regions_) {
+    region.data = std::make_unique<std::byte[]>(capacity);
+  }
+  current_ = &regions_[0];
+}
+
+void FrameArena::beginFrame(uint32_t frame_index) {
+  current_ = &regions_[frame_index];
+  current_->head.store(0, std::memory_order_relaxed);
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment) {
+  const uintptr_t base = reinterpret_cast<uintptr_t>(current_->data.get());
+  size_t head = current_->head.load(std::memory_order_relaxed);
+  while (true) {
+    const size_t begin =
+        ((base + head + alignment - 1) & ~(alignment - 1)) - base;
+    if (begin + size > capacity_) {
+      return nullptr;
+    }
+    if (current_->head.compare_exchange_weak(head, begin + size,
+                                             std::memory_order_relaxed)) {
+      return current_->data.get() + begin;
+    }
+  }
+}
+
+JobSystem::JobSystem(uint32_t thread_count, uint32_t frame_count,
+                     size_t arena_size)
+    : arena_(arena_size, frame_count) {
+  for (uint32_t i = 0; i <= thread_count; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  threads_.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void JobSystem::wait(JobCounter &counter) {
+  const uint32_t queue = currentQueue();
+  while (!counter.done()) {
+    Job job;
+    if (take(queue, job)) {
+      execute(job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock(counter.mutex_);
+    error = std::exchange(counter.error_, nullptr);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void JobSystem::parallelFor(
+    uint32_t count, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)> &body) {
+  grain = std::max(grain, 1u);
+  JobCounter counter;
+  for (uint32_t begin = 0; begin < count; begin += grain) {
+    const uint32_t end = begin + std::min(grain, count - begin);
+    run(counter, [&body, begin, end] { body(begin, end); });
+  }
+  wait(counter);
+}
+
+void JobSystem::submit(Job job, JobCounter *after) {
+  if (after != nullptr) {
+    std::lock_guard<std::mutex> lock(after->mutex_);
+    if (!after->done()) {
+      after->continuations_.push_back(job);
+      return;
+    }
+  }
+  push(job);
+}
+
+void JobSystem::push(Job job) {
+  Queue &queue = *queues_[currentQueue()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(job);
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  // Taking the lock orders the count before a sleeping worker's check.
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  work_ready_.notify_one();
+}
+
+bool JobSystem::take(uint32_t queue, Job &job) {
+  const uint32_t count = static_cast<uint32_t>(queues_.size());
+  for (uint32_t i = 0; i < count; ++i) {
+    Queue &victim = *queues_[(queue + i) % count];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.jobs.empty()) {
+      continue;
+    }
+    // Workers take their newest job; everything else is taken oldest
+    // first.
+    if (i == 0 && queue < size()) {
+      job = victim.jobs.back();
+      victim.jobs.pop_back();
+    } else {
+      job = victim.jobs.front();
+      victim.jobs.pop_front();
+    }
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void JobSystem::execute(const Job &job) {
+  std::exception_ptr error;
+  try {
+    job.invoke(job.closure, job.heap);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  JobCounter &counter = *job.counter;
+  std::vector<Job> continuations;
+  {
+    std::lock_guard<std::mutex> lock(counter.mutex_);
+    if (error && !counter.error_) {
+      counter.error_ = error;
+    }
+    if (counter.pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      continuations.swap(counter.continuations_);
+    }
+  }
+  for (const auto &continuation : continuations) {
+    push(continuation);
+  }
+}
+
+uint32_t JobSystem::currentQueue() const {
+  return current_system == this ? current_queue : size();
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+  current_system = this;
+  current_queue = index;
+  while (true) {
+    Job job;
+    if (take(index, job)) {
+      execute(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    work_ready_.wait(lock, [this] {
+      return stopping_ || queued_.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+} // namespace cg
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cg {
+// Bump allocator over host memory for the data of a frame's jobs, with one
+// region per frame slot. A slot's region is reclaimed by beginFrame() when
+// the slot comes around again, so data must not outlive frame_count frames.
+// allocate() is thread-safe; beginFrame() must not race it.
+class FrameArena {
+public:
+  FrameArena(size_t capacity, uint32_t frame_count);
+
+  void beginFrame(uint32_t frame_index);
+  // nullptr when the current region is full.
+  void *allocate(size_t size, size_t alignment);
+  size_t used() const {
+    return current_->head.load(std::memory_order_relaxed);
+  }
+  size_t capacity() const { return capacity_; }
+
+private:
+  struct Region {
+    std::unique_ptr<std::byte[]> data;
+    std::atomic<size_t> head{0};
+  };
+
+  size_t capacity_;
+  std::vector<Region> regions_;
+  Region *current_;
+};
+
+class JobCounter;
+
+// A type-erased call whose closure lives in a FrameArena or, when that is
+// full, on the heap. invoke() runs the call and destroys the closure.
+struct Job {
+  void (*invoke)(void *closure, bool heap) = nullptr;
+  void *closure = nullptr;
+  bool heap = false;
+  JobCounter *counter = nullptr;
+};
+
+// Tracks a group of jobs. JobSystem::wait() returns once every job run
+// against the counter has finished and rethrows the first exception one of
+// them threw. A counter must outlive its jobs and the jobs run after it.
+class JobCounter {
+public:
+  JobCounter() = default;
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+
+  std::atomic<uint32_t> pending_{0};
+  // Guards the rest, and the decrement of pending_ to zero so that a waiter
+  // cannot destroy the counter while a finishing job still uses it.
+  std::mutex mutex_;
+  std::exception_ptr error_;
+  // Jobs run after this counter, queued once it reaches zero.
+  std::vector<Job> continuations_;
+};
+
+// Work-stealing scheduler for the engine's CPU work. Every worker thread
+// owns a deque: it pushes and pops its own jobs at the back, so nested work
+// stays cache-warm, while idle workers steal the oldest jobs from the front
+// of the others'. Threads that are not workers submit into a shared deque
+// and help run jobs while they wait, so with no worker threads everything
+// runs on the waiting thread. Jobs should not block on anything but wait().
+class JobSystem {
+public:
+  static constexpr size_t kDefaultArenaSize = 1 << 20;
+
+  JobSystem(uint32_t thread_count, uint32_t frame_count,
+            size_t arena_size = kDefaultArenaSize);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  uint32_t size() const { return static_cast<uint32_t>(threads_.size()); }
+  // The worker threads plus the thread waiting on them.
+  uint32_t concurrency() const { return size() + 1; }
+
+  // Reclaims the job data of frame_index's previous use; call once per
+  // frame after waiting on the slot's fence, with no jobs running.
+  void beginFrame(uint32_t frame_index) { arena_.beginFrame(frame_index); }
+  FrameArena &arena() { return arena_; }
+
+  // Queues function() against counter, or, given after, once every job of
+  // after has finished.
+  template <typename Function>
+  void run(JobCounter &counter, Function &&function,
+           JobCounter *after = nullptr);
+  // Runs queued jobs on the calling thread until counter's are done.
+  void wait(JobCounter &counter);
+  // Calls body(begin, end) over [0, count) in ranges of at most grain
+  // indices, spread across the workers and the calling thread, and returns
+  // once all have finished.
+  void parallelFor(uint32_t count, uint32_t grain,
+                   const std::function<void(uint32_t, uint32_t)> &body);
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  void submit(Job job, JobCounter *after);
+  void push(Job job);
+  // The calling thread's job, or one stolen from another queue.
+  bool take(uint32_t queue, Job &job);
+  void execute(const Job &job);
+  // The calling thread's queue: its own for workers, else the shared one.
+  uint32_t currentQueue() const;
+  void workerLoop(uint32_t index);
+
+  FrameArena arena_;
+  // One per worker, then the one shared by other threads.
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::atomic<uint32_t> queued_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable work_ready_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+template <typename Function>
+void JobSystem::run(JobCounter &counter, Function &&function,
+                    JobCounter *after) {
+  using Closure = std::decay_t<Function>;
+  Job job;
+  void *memory = arena_.allocate(sizeof(Closure), alignof(Closure));
+  job.heap = memory == nullptr;
+  job.closure = job.heap ? new Closure(std::forward<Function>(function))
+                         : new (memory)
+                               Closure(std::forward<Function>(function));
+  job.invoke = [](void *closure, bool heap) {
+    auto *call = static_cast<Closure *>(closure);
+    const auto release = [&] {
+      if (heap) {
+        delete call;
+      } else {
+        call->~Closure();
+      }
+    };
+    try {
+      (*call)();
+    } catch (...) {
+      release();
+      throw;
+    }
+    release();
+  };
+  job.counter = &counter;
+  counter.pending_.fetch_add(1, std::memory_order_relaxed);
+  submit(job, after);
+}
+} // namespace cg
@@ -1,6 +1,12 @@
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
 
 #include "computer_graphics_application.h"
+#include "shader/shader_utils.h"
 
 /*
 #define GLFW_INCLUDE_VULKAN
@@ -13,10 +19,139 @@
 #include <iostream>
 */
 
-int main() {
-  cg::ComputerGraphicsApplication app;
+namespace {
+uint32_t parseUint(const char *value, const char *flag) {
   try {
-    app.run();
+    return static_cast<uint32_t>(std::stoul(value));
+  } catch (const std::exception &) {
+    throw std::runtime_error(std::string("invalid value for ") + flag + ": " +
+                             value);
+  }
+}
+
+constexpr uint32_t kDefaultBenchmarkFrames = 1000;
+
+struct CommandLine {
+  cg::ApplicationOptions options;
+  // Headless only: where to write the last rendered frame as a PPM image.
+  std::string output_path;
+
+  bool benchmark = false;
+  std::optional<uint32_t> frame_count;
+  uint32_t warmup_frames = 100;
+  std::string report_path = "benchmark.json";
+};
+
+CommandLine parseCommandLine(int argc, char **argv) {
+  CommandLine command_line;
+  cg::ApplicationOptions &options = command_line.options;
+  for (int i = 1; i < argc; ++i) {
+    const char *flag = argv[i];
+    if (std::strcmp(flag, "--frames-in-flight") == 0 && i + 1 < argc) {
+      options.frames_in_flight = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--headless") == 0) {
+      options.headless = true;
+    } else if (std::strcmp(flag, "--width") == 0 && i + 1 < argc) {
+      options.width = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--height") == 0 && i + 1 < argc) {
+      options.height = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--frames") == 0 && i + 1 < argc) {
+      command_line.frame_count = parseUint(argv[++i], flag);
+      options.frame_count = command_line.frame_count.value();
+    } else if (std::strcmp(flag, "--output") == 0 && i + 1 < argc) {
+      command_line.output_path = argv[++i];
+    } else if (std::strcmp(flag, "--gpu-log-interval") == 0 && i + 1 < argc) {
+      options.gpu_log_interval = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--instances") == 0 && i + 1 < argc) {
+      options.instance_count = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--job-threads") == 0 && i + 1 < argc) {
+      options.job_threads = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--recording-threads") == 0 &&
+               i + 1 < argc) {
+      options.recording_threads = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--static") == 0) {
+      options.static_scene = true;
+    } else if (std::strcmp(flag, "--gpu-culling") == 0) {
+      options.gpu_culling = true;
+    } else if (std::strcmp(flag, "--cpu-culling") == 0) {
+      options.cpu_culling = true;
+    } else if (std::strcmp(flag, "--bindless") == 0) {
+      options.bindless = true;
+    } else if (std::strcmp(flag, "--depth-prepass") == 0) {
+      options.depth_prepass = true;
+    } else if (std::strcmp(flag, "--msaa") == 0 && i + 1 < argc) {
+      options.msaa_samples = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--mesh-file") == 0 && i + 1 < argc) {
+      options.mesh_file = argv[++i];
+    } else if (std::strcmp(flag, "--texture") == 0 && i + 1 < argc) {
+      options.textures.push_back(argv[++i]);
+    } else if (std::strcmp(flag, "--texture-budget") == 0 && i + 1 < argc) {
+      options.texture_budget_mb = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--pipeline-cache") == 0 && i + 1 < argc) {
+      options.pipeline_cache_path = argv[++i];
+    } else if (std::strcmp(flag, "--pipeline-cache-save-interval") == 0 &&
+               i + 1 < argc) {
+      options.pipeline_cache_save_interval = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--pipeline-threads") == 0 && i + 1 < argc) {
+      options.pipeline_compile_threads = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--shader-dir") == 0 && i + 1 < argc) {
+      cg::setShaderOverrideDirectory(argv[++i]);
+    } else if (std::strcmp(flag, "--bench") == 0) {
+      command_line.benchmark = true;
+    } else if (std::strcmp(flag, "--warmup") == 0 && i + 1 < argc) {
+      command_line.warmup_frames = parseUint(argv[++i], flag);
+    } else if (std::strcmp(flag, "--report") == 0 && i + 1 < argc) {
+      command_line.report_path = argv[++i];
+    } else {
+      throw std::runtime_error(std::string("unknown argument: ") + flag);
+    }
+  }
+  if (options.pipeline_compile_threads == 0) {
+    throw std::runtime_error("--pipeline-threads must be at least 1");
+  }
+  if (!command_line.output_path.empty() && !options.headless) {
+    throw std::runtime_error("--output requires --headless");
+  }
+  return command_line;
+}
+
+void writePpm(const cg::FrameImage &image, const std::string &path) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  file << "P6\n" << image.width << ' ' << image.height << "\n255\n";
+  for (size_t i = 0; i < image.pixels.size(); i += 4) {
+    file.write(reinterpret_cast<const char *>(&image.pixels[i]), 3);
+  }
+}
+
+void runBenchmark(cg::ComputerGraphicsApplication &app,
+                  const CommandLine &command_line) {
+  const cg::BenchmarkReport report = app.benchmark(
+      command_line.frame_count.value_or(kDefaultBenchmarkFrames),
+      command_line.warmup_frames);
+  cg::printBenchmarkSummary(report, std::cout);
+  std::ofstream file(command_line.report_path);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + command_line.report_path);
+  }
+  cg::writeBenchmarkJson(report, file);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const CommandLine command_line = parseCommandLine(argc, argv);
+    cg::ComputerGraphicsApplication app(command_line.options);
+    if (command_line.benchmark) {
+      runBenchmark(app, command_line);
+    } else {
+      app.run();
+    }
+    if (!command_line.output_path.empty()) {
+      writePpm(app.readbackFrame(), command_line.output_path);
+    }
   } catch (const std::exception &ex) {
     std::cerr << ex.what() << std::endl;
     return EXIT_FAILURE;
@@ -0,0 +1,134 @@
+#include "mesh.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace cg {
+uint32_t formatSize(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8_UNORM:
+    return 1;
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_R16G16_SNORM:
+  case VK_FORMAT_R16G16_UNORM:
+  case VK_FORMAT_R16G16_SFLOAT:
+  case VK_FORMAT_R32_SFLOAT:
+  case VK_FORMAT_R32_UINT:
+    return 4;
+  case VK_FORMAT_R16G16B16A16_SNORM:
+  case VK_FORMAT_R16G16B16A16_UNORM:
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+  case VK_FORMAT_R32G32_SFLOAT:
+    return 8;
+  case VK_FORMAT_R32G32B32_SFLOAT:
+    return 12;
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+    return 16;
+  default:
+    throw std::runtime_error("unsupported vertex format!");
+  }
+}
+
+VertexLayout &VertexLayout::addBinding(const std::vector<VkFormat> &formats,
+                                       VkVertexInputRate rate) {
+  const uint32_t binding = static_cast<uint32_t>(bindings_.size());
+  uint32_t offset = 0;
+  for (const VkFormat format : formats) {
+    VkVertexInputAttributeDescription attribute{};
+    attribute.location = static_cast<uint32_t>(attributes_.size());
+    attribute.binding = binding;
+    attribute.format = format;
+    attribute.offset = offset;
+    attributes_.push_back(attribute);
+    offset += formatSize(format);
+  }
+  VkVertexInputBindingDescription description{};
+  description.binding = binding;
+  description.stride = offset;
+  description.inputRate = rate;
+  bindings_.push_back(description);
+  return *this;
+}
+
+VkPipelineVertexInputStateCreateInfo VertexLayout::createInfo() const {
+  VkPipelineVertexInputStateCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  info.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings_.size());
+  info.pVertexBindingDescriptions = bindings_.data();
+  info.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(attributes_.size());
+  info.pVertexAttributeDescriptions = attributes_.data();
+  return info;
+}
+
+void Mesh::bind(VkCommandBuffer command_buffer, uint32_t first_binding) const {
+  const std::vector<VkBuffer> buffers(stream_offsets.size(), vertices.buffer);
+  vkCmdBindVertexBuffers(command_buffer, first_binding,
+                         static_cast<uint32_t>(buffers.size()), buffers.data(),
+                         stream_offsets.data());
+  vkCmdBindIndexBuffer(command_buffer, indices.buffer, 0, index_type);
+}
+
+void Mesh::draw(VkCommandBuffer command_buffer, uint32_t instance_count,
+                uint32_t first_instance) const {
+  vkCmdDrawIndexed(command_buffer, index_count, instance_count, 0, 0,
+                   first_instance);
+}
+
+void Mesh::drawIndirect(VkCommandBuffer command_buffer, const VkBuffer &buffer,
+                        VkDeviceSize offset) const {
+  vkCmdDrawIndexedIndirect(command_buffer, buffer, offset, 1,
+                           sizeof(VkDrawIndexedIndirectCommand));
+}
+
+std::vector<Mesh> uploadMeshes(const std::vector<MeshData> &meshes,
+                               DeviceAllocator &allocator, UploadBatch &batch) {
+  std::vector<Mesh> result;
+  for (const auto &data : meshes) {
+    if (data.streams.empty() || data.indices.empty()) {
+      throw std::runtime_error("mesh has no geometry!");
+    }
+    Mesh mesh;
+    VkDeviceSize vertex_size = 0;
+    for (const auto &stream : data.streams) {
+      mesh.stream_offsets.push_back(vertex_size);
+      // Keep each stream aligned for its widest attribute.
+      vertex_size = (vertex_size + stream.size() + 15) & ~VkDeviceSize{15};
+    }
+    mesh.vertices = createBuffer(
+        allocator, vertex_size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (size_t i = 0; i < data.streams.size(); ++i) {
+      batch.add(mesh.vertices.buffer, mesh.stream_offsets[i],
+                data.streams[i].data(), data.streams[i].size());
+    }
+
+    mesh.index_count = static_cast<uint32_t>(data.indices.size());
+    mesh.bounds = data.bounds;
+    std::vector<uint8_t> index_bytes;
+    // Narrowed by value rather than by vertex_count, which callers may
+    // leave unset.
+    const uint32_t max_index =
+        *std::max_element(data.indices.begin(), data.indices.end());
+    if (max_index <= UINT16_MAX) {
+      mesh.index_type = VK_INDEX_TYPE_UINT16;
+      index_bytes = toBytes(
+          std::vector<uint16_t>(data.indices.begin(), data.indices.end()));
+    } else {
+      mesh.index_type = VK_INDEX_TYPE_UINT32;
+      index_bytes = toBytes(data.indices);
+    }
+    mesh.indices = createBuffer(
+        allocator, index_bytes.size(),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    batch.add(mesh.indices.buffer, 0, index_bytes.data(), index_bytes.size());
+    result.push_back(std::move(mesh));
+  }
+  return result;
+}
+} // namespace cg
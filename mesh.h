@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+
+namespace cg {
+uint32_t formatSize(VkFormat format);
+
+// Vertex input bindings and attributes of a pipeline. Attribute locations are
+// assigned in the order they are added, so one addBinding() with every
+// attribute describes an interleaved layout and one addBinding() per
+// attribute a structure-of-arrays layout.
+class VertexLayout {
+public:
+  VertexLayout &
+  addBinding(const std::vector<VkFormat> &formats,
+             VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX);
+
+  const std::vector<VkVertexInputBindingDescription> &bindings() const {
+    return bindings_;
+  }
+  const std::vector<VkVertexInputAttributeDescription> &attributes() const {
+    return attributes_;
+  }
+
+  // Points into this layout, which must outlive the returned struct.
+  VkPipelineVertexInputStateCreateInfo createInfo() const;
+
+private:
+  std::vector<VkVertexInputBindingDescription> bindings_;
+  std::vector<VkVertexInputAttributeDescription> attributes_;
+};
+
+template <typename T>
+std::vector<uint8_t> toBytes(const std::vector<T> &values) {
+  std::vector<uint8_t> bytes(values.size() * sizeof(T));
+  std::memcpy(bytes.data(), values.data(), bytes.size());
+  return bytes;
+}
+
+// Bounding circle in mesh space.
+struct Bounds {
+  float center[2] = {0.0f, 0.0f};
+  float radius = 0.0f;
+};
+
+// Host-side geometry: one byte stream per per-vertex binding of the layout
+// the mesh is drawn with.
+struct MeshData {
+  std::vector<std::vector<uint8_t>> streams;
+  uint32_t vertex_count = 0;
+  std::vector<uint32_t> indices;
+  Bounds bounds;
+};
+
+// Device-local geometry. Vertex streams are stored back to back in one
+// buffer; indices are 16-bit whenever the largest index fits.
+struct Mesh {
+  Buffer vertices;
+  std::vector<VkDeviceSize> stream_offsets;
+  Buffer indices;
+  VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+  uint32_t index_count = 0;
+  Bounds bounds;
+
+  // Binds the vertex streams to consecutive bindings from first_binding and
+  // the index buffer.
+  void bind(VkCommandBuffer command_buffer, uint32_t first_binding = 0) const;
+  void draw(VkCommandBuffer command_buffer, uint32_t instance_count = 1,
+            uint32_t first_instance = 0) const;
+  // Draws with the parameters of the VkDrawIndexedIndirectCommand at offset.
+  void drawIndirect(VkCommandBuffer command_buffer, const VkBuffer &buffer,
+                    VkDeviceSize offset) const;
+
+  void destroy(DeviceAllocator &allocator) {
+    vertices.destroy(allocator);
+    indices.destroy(allocator);
+  }
+};
+
+// Creates device-local buffers for every mesh and queues their contents on
+// batch. The meshes must not be drawn before batch has been submitted.
+std::vector<Mesh> uploadMeshes(const std::vector<MeshData> &meshes,
+                               DeviceAllocator &allocator, UploadBatch &batch);
+} // namespace cg
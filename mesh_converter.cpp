@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mesh_format.h"
+
+// Converts Wavefront OBJ files into one binary mesh file, one mesh per input.
+// Positions keep x and y as half floats; per-vertex colors ("v x y z r g b")
+// become RGBA8 and normals, if requested, octahedral SNORM16.
+
+namespace {
+struct ObjVertex {
+  float position[3];
+  float color[3];
+};
+
+struct ObjMesh {
+  std::vector<ObjVertex> vertices;
+  std::vector<std::array<float, 3>> normals;
+  // Triangulated corners as (vertex, normal) indices; normal is -1 if none.
+  std::vector<std::pair<int, int>> corners;
+};
+
+// Resolves a 1-based, possibly negative, OBJ index.
+int resolveIndex(const std::string &token, size_t count, size_t line) {
+  int index = 0;
+  size_t parsed = 0;
+  try {
+    index = std::stoi(token, &parsed);
+  } catch (const std::logic_error &) {
+    parsed = 0;
+  }
+  if (parsed == 0 || parsed != token.size()) {
+    throw std::runtime_error("invalid index \"" + token + "\" on line " +
+                             std::to_string(line));
+  }
+  const int resolved = index < 0 ? static_cast<int>(count) + index : index - 1;
+  if (index == 0 || resolved < 0 || resolved >= static_cast<int>(count)) {
+    throw std::runtime_error("index out of range on line " +
+                             std::to_string(line));
+  }
+  return resolved;
+}
+
+ObjMesh parseObj(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("file " + path + " not found");
+  }
+  ObjMesh mesh;
+  std::string text;
+  for (size_t line = 1; std::getline(file, text); ++line) {
+    std::istringstream stream(text);
+    std::string keyword;
+    stream >> keyword;
+    if (keyword == "v") {
+      ObjVertex vertex{{0.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}};
+      if (!(stream >> vertex.position[0] >> vertex.position[1] >>
+            vertex.position[2])) {
+        throw std::runtime_error("invalid vertex on line " +
+                                 std::to_string(line));
+      }
+      float color[3];
+      if (stream >> color[0] >> color[1] >> color[2]) {
+        std::copy(color, color + 3, vertex.color);
+      }
+      mesh.vertices.push_back(vertex);
+    } else if (keyword == "vn") {
+      std::array<float, 3> normal{};
+      if (!(stream >> normal[0] >> normal[1] >> normal[2])) {
+        throw std::runtime_error("invalid normal on line " +
+                                 std::to_string(line));
+      }
+      mesh.normals.push_back(normal);
+    } else if (keyword == "f") {
+      std::vector<std::pair<int, int>> face;
+      std::string corner;
+      while (stream >> corner) {
+        // v, v/vt, v//vn or v/vt/vn.
+        const size_t first = corner.find('/');
+        const int vertex =
+            resolveIndex(corner.substr(0, first), mesh.vertices.size(), line);
+        int normal = -1;
+        if (first != std::string::npos) {
+          const size_t second = corner.find('/', first + 1);
+          if (second != std::string::npos && second + 1 < corner.size()) {
+            normal = resolveIndex(corner.substr(second + 1),
+                                  mesh.normals.size(), line);
+          }
+        }
+        face.emplace_back(vertex, normal);
+      }
+      if (face.size() < 3) {
+        throw std::runtime_error("degenerate face on line " +
+                                 std::to_string(line));
+      }
+      for (size_t i = 1; i + 1 < face.size(); ++i) {
+        mesh.corners.push_back(face[0]);
+        mesh.corners.push_back(face[i]);
+        mesh.corners.push_back(face[i + 1]);
+      }
+    }
+  }
+  if (mesh.corners.empty()) {
+    throw std::runtime_error(path + " has no faces");
+  }
+  return mesh;
+}
+
+template <typename T> void append(std::vector<uint8_t> &bytes, const T &value) {
+  const auto *data = reinterpret_cast<const uint8_t *>(&value);
+  bytes.insert(bytes.end(), data, data + sizeof(T));
+}
+
+uint8_t toUnorm8(float value) {
+  return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255));
+}
+
+cg::EncodedMesh encode(const ObjMesh &obj, bool normals) {
+  cg::EncodedMesh mesh;
+  std::vector<cg::MeshFileAttribute> attributes = {
+      {cg::VertexSemantic::kPosition, VK_FORMAT_R16G16_SFLOAT},
+      {cg::VertexSemantic::kColor, VK_FORMAT_R8G8B8A8_UNORM},
+  };
+  if (normals) {
+    attributes.push_back({cg::VertexSemantic::kNormal, VK_FORMAT_R16G16_SNORM});
+  }
+  mesh.stream_attributes = {attributes};
+
+  // OBJ indexes positions and normals separately; every distinct pair
+  // becomes one vertex.
+  std::map<std::pair<int, int>, uint32_t> vertex_ids;
+  std::vector<uint8_t> stream;
+  float min[2] = {INFINITY, INFINITY};
+  float max[2] = {-INFINITY, -INFINITY};
+  for (const auto &corner : obj.corners) {
+    const std::pair<int, int> key{corner.first, normals ? corner.second : -1};
+    const auto [it, inserted] =
+        vertex_ids.emplace(key, static_cast<uint32_t>(vertex_ids.size()));
+    mesh.data.indices.push_back(it->second);
+    if (!inserted) {
+      continue;
+    }
+    const ObjVertex &vertex = obj.vertices[corner.first];
+    append(stream, cg::toHalf(vertex.position[0]));
+    append(stream, cg::toHalf(vertex.position[1]));
+    for (const float channel : vertex.color) {
+      append(stream, toUnorm8(channel));
+    }
+    append(stream, uint8_t{255});
+    if (normals) {
+      const float up[3] = {0.0f, 0.0f, 1.0f};
+      const float *normal =
+          key.second >= 0 ? obj.normals[key.second].data() : up;
+      int16_t encoded[2];
+      cg::encodeOctahedral(normal, encoded);
+      append(stream, encoded[0]);
+      append(stream, encoded[1]);
+    }
+    for (int axis = 0; axis < 2; ++axis) {
+      min[axis] = std::min(min[axis], vertex.position[axis]);
+      max[axis] = std::max(max[axis], vertex.position[axis]);
+    }
+  }
+  mesh.data.vertex_count = static_cast<uint32_t>(vertex_ids.size());
+  mesh.data.streams = {std::move(stream)};
+
+  cg::Bounds &bounds = mesh.data.bounds;
+  bounds.center[0] = (min[0] + max[0]) / 2;
+  bounds.center[1] = (min[1] + max[1]) / 2;
+  for (const auto &[key, id] : vertex_ids) {
+    const ObjVertex &vertex = obj.vertices[key.first];
+    bounds.radius = std::max(
+        bounds.radius, std::hypot(vertex.position[0] - bounds.center[0],
+                                  vertex.position[1] - bounds.center[1]));
+  }
+  return mesh;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  bool normals = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--normals") == 0) {
+      normals = true;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.size() < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " [--normals] input.obj... output.cgmesh" << std::endl;
+    return EXIT_FAILURE;
+  }
+  try {
+    std::vector<cg::EncodedMesh> meshes;
+    for (size_t i = 0; i + 1 < paths.size(); ++i) {
+      meshes.push_back(encode(parseObj(paths[i]), normals));
+    }
+    cg::writeMeshFile(paths.back(), meshes);
+  } catch (const std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,299 @@
+#include "mesh_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+uint64_t alignUp(uint64_t value) {
+  return (value + kMeshFileAlignment - 1) & ~(kMeshFileAlignment - 1);
+}
+
+uint32_t indexSize(uint32_t index_type) {
+  switch (index_type) {
+  case VK_INDEX_TYPE_UINT16:
+    return 2;
+  case VK_INDEX_TYPE_UINT32:
+    return 4;
+  default:
+    throw std::runtime_error("unsupported index type in mesh file!");
+  }
+}
+
+// Whether [offset, offset + size) is an aligned range within file_size.
+bool isValidSection(uint64_t offset, uint64_t size, uint64_t file_size) {
+  return offset % kMeshFileAlignment == 0 && offset <= file_size &&
+         size <= file_size - offset;
+}
+
+// Whether all count indices at data refer to one of vertex_count vertices.
+template <typename Index>
+bool areIndicesInRange(const uint8_t *data, uint32_t count,
+                       uint32_t vertex_count) {
+  const Index *indices = reinterpret_cast<const Index *>(data);
+  return std::all_of(indices, indices + count, [&](Index index) {
+    return index < vertex_count;
+  });
+}
+
+void validateRecord(const MeshFileRecord &record, const uint8_t *file_data,
+                    uint64_t file_size) {
+  if (record.vertex_count == 0 || record.index_count == 0 ||
+      record.stream_count == 0 || record.stream_count > kMaxMeshFileStreams) {
+    throw std::runtime_error("invalid mesh record in mesh file!");
+  }
+  for (uint32_t i = 0; i < record.stream_count; ++i) {
+    const MeshFileStream &stream = record.streams[i];
+    if (stream.attribute_count == 0 ||
+        stream.attribute_count > kMaxMeshFileAttributes) {
+      throw std::runtime_error("invalid vertex stream in mesh file!");
+    }
+    uint32_t stride = 0;
+    for (uint32_t j = 0; j < stream.attribute_count; ++j) {
+      stride += formatSize(static_cast<VkFormat>(stream.attributes[j].format));
+    }
+    if (stride != stream.stride ||
+        stream.size != uint64_t{stream.stride} * record.vertex_count ||
+        !isValidSection(stream.offset, stream.size, file_size)) {
+      throw std::runtime_error("invalid vertex stream in mesh file!");
+    }
+  }
+  if (record.index_size !=
+          uint64_t{indexSize(record.index_type)} * record.index_count ||
+      !isValidSection(record.index_offset, record.index_size, file_size)) {
+    throw std::runtime_error("invalid index section in mesh file!");
+  }
+  // An index past the vertex streams would fetch out of bounds on the GPU.
+  const uint8_t *indices = file_data + record.index_offset;
+  const bool in_range =
+      record.index_type == VK_INDEX_TYPE_UINT16
+          ? areIndicesInRange<uint16_t>(indices, record.index_count,
+                                        record.vertex_count)
+          : areIndicesInRange<uint32_t>(indices, record.index_count,
+                                        record.vertex_count);
+  if (!in_range) {
+    throw std::runtime_error("index out of range in mesh file!");
+  }
+}
+
+template <typename T> void writeValue(std::ofstream &file, const T &value) {
+  file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void padTo(std::ofstream &file, uint64_t offset) {
+  const uint64_t position = static_cast<uint64_t>(file.tellp());
+  const std::vector<char> zeros(offset - position, 0);
+  file.write(zeros.data(), zeros.size());
+}
+} // namespace
+
+MeshFile::MeshFile(const std::string &path) : file_(path) {
+  if (file_.size() < sizeof(MeshFileHeader)) {
+    throw std::runtime_error(path + " is not a mesh file");
+  }
+  const MeshFileHeader &file_header = header();
+  if (file_header.magic != kMeshFileMagic) {
+    throw std::runtime_error(path + " is not a mesh file");
+  }
+  if (file_header.version != kMeshFileVersion) {
+    throw std::runtime_error(path + " has unsupported mesh file version " +
+                             std::to_string(file_header.version));
+  }
+  if (file_header.file_size != file_.size() ||
+      file_header.mesh_count > (file_.size() - sizeof(MeshFileHeader)) /
+                                   sizeof(MeshFileRecord)) {
+    throw std::runtime_error(path + " is truncated");
+  }
+  for (uint32_t i = 0; i < meshCount(); ++i) {
+    validateRecord(record(i), file_.data(), file_.size());
+  }
+}
+
+VertexLayout MeshFile::vertexLayout(uint32_t mesh) const {
+  const MeshFileRecord &mesh_record = record(mesh);
+  VertexLayout layout;
+  for (uint32_t i = 0; i < mesh_record.stream_count; ++i) {
+    const MeshFileStream &stream = mesh_record.streams[i];
+    std::vector<VkFormat> formats;
+    for (uint32_t j = 0; j < stream.attribute_count; ++j) {
+      formats.push_back(static_cast<VkFormat>(stream.attributes[j].format));
+    }
+    layout.addBinding(formats);
+  }
+  return layout;
+}
+
+std::vector<Mesh> uploadMeshes(const MeshFile &file, DeviceAllocator &allocator,
+                               UploadBatch &batch) {
+  std::vector<Mesh> result;
+  for (uint32_t i = 0; i < file.meshCount(); ++i) {
+    const MeshFileRecord &record = file.record(i);
+    Mesh mesh;
+    VkDeviceSize vertex_size = 0;
+    for (uint32_t j = 0; j < record.stream_count; ++j) {
+      mesh.stream_offsets.push_back(vertex_size);
+      vertex_size = alignUp(vertex_size + record.streams[j].size);
+    }
+    mesh.vertices = createBuffer(
+        allocator, vertex_size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (uint32_t j = 0; j < record.stream_count; ++j) {
+      const MeshFileStream &stream = record.streams[j];
+      batch.addReference(mesh.vertices.buffer, mesh.stream_offsets[j],
+                         file.section(stream.offset), stream.size);
+    }
+
+    mesh.index_type = static_cast<VkIndexType>(record.index_type);
+    mesh.index_count = record.index_count;
+    mesh.indices = createBuffer(
+        allocator, record.index_size,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    batch.addReference(mesh.indices.buffer, 0,
+                       file.section(record.index_offset), record.index_size);
+    mesh.bounds = {{record.bounds_center[0], record.bounds_center[1]},
+                   record.bounds_radius};
+    result.push_back(std::move(mesh));
+  }
+  return result;
+}
+
+void writeMeshFile(const std::string &path,
+                   const std::vector<EncodedMesh> &meshes) {
+  std::vector<MeshFileRecord> records(meshes.size());
+  uint64_t offset =
+      alignUp(sizeof(MeshFileHeader) + meshes.size() * sizeof(MeshFileRecord));
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const MeshData &data = meshes[i].data;
+    const auto &stream_attributes = meshes[i].stream_attributes;
+    if (data.streams.empty() || data.streams.size() > kMaxMeshFileStreams ||
+        stream_attributes.size() != data.streams.size()) {
+      throw std::runtime_error("mesh has an unsupported stream layout!");
+    }
+    MeshFileRecord &record = records[i];
+    record = {};
+    record.vertex_count = data.vertex_count;
+    record.index_count = static_cast<uint32_t>(data.indices.size());
+    record.index_type = data.vertex_count <= UINT16_MAX + 1u
+                            ? VK_INDEX_TYPE_UINT16
+                            : VK_INDEX_TYPE_UINT32;
+    record.stream_count = static_cast<uint32_t>(data.streams.size());
+    for (size_t j = 0; j < data.streams.size(); ++j) {
+      MeshFileStream &stream = record.streams[j];
+      if (stream_attributes[j].size() > kMaxMeshFileAttributes) {
+        throw std::runtime_error("mesh has an unsupported stream layout!");
+      }
+      stream.attribute_count =
+          static_cast<uint32_t>(stream_attributes[j].size());
+      for (size_t k = 0; k < stream_attributes[j].size(); ++k) {
+        stream.attributes[k] = stream_attributes[j][k];
+        stream.stride +=
+            formatSize(static_cast<VkFormat>(stream_attributes[j][k].format));
+      }
+      stream.offset = offset;
+      stream.size = data.streams[j].size();
+      if (stream.size != uint64_t{stream.stride} * data.vertex_count) {
+        throw std::runtime_error("vertex stream size does not match layout!");
+      }
+      offset = alignUp(offset + stream.size);
+    }
+    record.index_offset = offset;
+    record.index_size =
+        uint64_t{indexSize(record.index_type)} * record.index_count;
+    offset = alignUp(offset + record.index_size);
+    record.bounds_center[0] = data.bounds.center[0];
+    record.bounds_center[1] = data.bounds.center[1];
+    record.bounds_radius = data.bounds.radius;
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  const MeshFileHeader header{kMeshFileMagic, kMeshFileVersion,
+                              static_cast<uint32_t>(meshes.size()), 0,
+                              offset};
+  writeValue(file, header);
+  for (const auto &record : records) {
+    writeValue(file, record);
+  }
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const MeshData &data = meshes[i].data;
+    const MeshFileRecord &record = records[i];
+    for (size_t j = 0; j < data.streams.size(); ++j) {
+      padTo(file, record.streams[j].offset);
+      file.write(reinterpret_cast<const char *>(data.streams[j].data()),
+                 data.streams[j].size());
+    }
+    padTo(file, record.index_offset);
+    if (record.index_type == VK_INDEX_TYPE_UINT16) {
+      const std::vector<uint16_t> indices(data.indices.begin(),
+                                          data.indices.end());
+      file.write(reinterpret_cast<const char *>(indices.data()),
+                 record.index_size);
+    } else {
+      file.write(reinterpret_cast<const char *>(data.indices.data()),
+                 record.index_size);
+    }
+  }
+  padTo(file, offset);
+  if (!file) {
+    throw std::runtime_error("failed to write " + path);
+  }
+}
+
+uint16_t toHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t biased = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (biased == 0xff) {
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+  }
+  const int32_t exponent = static_cast<int32_t>(biased) - 127 + 15;
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    // Subnormal: shift the mantissa, with its implicit bit, into place.
+    mantissa |= 0x800000;
+    const uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    uint32_t half = mantissa >> shift;
+    half += (mantissa >> (shift - 1)) & 1;
+    return static_cast<uint16_t>(sign | half);
+  }
+  // Rounding may carry into the exponent, which is still correct.
+  uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+  half += (mantissa >> 12) & 1;
+  return static_cast<uint16_t>(sign | half);
+}
+
+int16_t toSnorm16(float value) {
+  return static_cast<int16_t>(
+      std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+void encodeOctahedral(const float normal[3], int16_t encoded[2]) {
+  const float length =
+      std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+  float x = length > 0.0f ? normal[0] / length : 0.0f;
+  float y = length > 0.0f ? normal[1] / length : 0.0f;
+  // Fold the lower hemisphere over the diagonals.
+  if (normal[2] < 0.0f) {
+    const float folded_x = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float folded_y = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = folded_x;
+    y = folded_y;
+  }
+  encoded[0] = toSnorm16(x);
+  encoded[1] = toSnorm16(y);
+}
+} // namespace cg
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+#include "mapped_file.h"
+#include "mesh.h"
+
+namespace cg {
+// Binary mesh container, little-endian:
+//   MeshFileHeader
+//   MeshFileRecord[mesh_count]
+//   vertex stream and index sections, each aligned to kMeshFileAlignment
+// Section offsets are from the start of the file, so a mapped file is used
+// in place.
+constexpr uint32_t kMeshFileMagic = 0x424d4743; // "CGMB"
+constexpr uint32_t kMeshFileVersion = 1;
+constexpr uint64_t kMeshFileAlignment = 16;
+constexpr uint32_t kMaxMeshFileStreams = 4;
+constexpr uint32_t kMaxMeshFileAttributes = 4;
+
+enum class VertexSemantic : uint32_t {
+  kPosition = 0,
+  kColor = 1,
+  // Octahedral-encoded unit vector.
+  kNormal = 2,
+  kTexcoord = 3,
+};
+
+struct MeshFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t mesh_count;
+  uint32_t reserved;
+  uint64_t file_size;
+};
+
+struct MeshFileAttribute {
+  VertexSemantic semantic;
+  // A VkFormat.
+  uint32_t format;
+};
+
+// One interleaved vertex stream.
+struct MeshFileStream {
+  uint32_t attribute_count;
+  uint32_t stride;
+  MeshFileAttribute attributes[kMaxMeshFileAttributes];
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct MeshFileRecord {
+  uint32_t vertex_count;
+  uint32_t index_count;
+  // A VkIndexType.
+  uint32_t index_type;
+  uint32_t stream_count;
+  MeshFileStream streams[kMaxMeshFileStreams];
+  uint64_t index_offset;
+  uint64_t index_size;
+  float bounds_center[2];
+  float bounds_radius;
+  uint32_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<MeshFileRecord>);
+static_assert(sizeof(MeshFileHeader) % 8 == 0);
+static_assert(sizeof(MeshFileRecord) % 8 == 0);
+
+// A mesh file mapped into memory. The constructor validates every record
+// against the file size and every index against its mesh's vertex count, so
+// sections can be read without further checks.
+class MeshFile {
+public:
+  explicit MeshFile(const std::string &path);
+
+  uint32_t meshCount() const { return header().mesh_count; }
+  const MeshFileRecord &record(uint32_t mesh) const {
+    return reinterpret_cast<const MeshFileRecord *>(
+        file_.data() + sizeof(MeshFileHeader))[mesh];
+  }
+  const uint8_t *section(uint64_t offset) const {
+    return file_.data() + offset;
+  }
+
+  // The vertex streams of mesh as consecutive per-vertex bindings.
+  VertexLayout vertexLayout(uint32_t mesh) const;
+
+private:
+  const MeshFileHeader &header() const {
+    return *reinterpret_cast<const MeshFileHeader *>(file_.data());
+  }
+
+  MappedFile file_;
+};
+
+// Creates device-local buffers for every mesh of file and queues their
+// contents on batch straight from the mapping, so file must stay alive until
+// batch has been submitted.
+std::vector<Mesh> uploadMeshes(const MeshFile &file, DeviceAllocator &allocator,
+                               UploadBatch &batch);
+
+// Host-side input of writeMeshFile(): the streams of data are interleaved
+// with the attributes of the matching stream_attributes entry.
+struct EncodedMesh {
+  MeshData data;
+  std::vector<std::vector<MeshFileAttribute>> stream_attributes;
+};
+
+void writeMeshFile(const std::string &path,
+                   const std::vector<EncodedMesh> &meshes);
+
+// Quantization helpers for encoding attributes.
+uint16_t toHalf(float value);
+int16_t toSnorm16(float value);
+// Maps a unit vector to two signed-normalized octahedral coordinates.
+void encodeOctahedral(const float normal[3], int16_t encoded[2]);
+} // namespace cg
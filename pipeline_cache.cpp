@@ -0,0 +1,135 @@
+#include "pipeline_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cg {
+namespace {
+// Layout of VkPipelineCacheHeaderVersionOne as stored in the data blob.
+constexpr size_t kHeaderSize = 16 + VK_UUID_SIZE;
+
+uint32_t readUint32(const char *data) {
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+  return uint32_t{bytes[0]} | uint32_t{bytes[1]} << 8 |
+         uint32_t{bytes[2]} << 16 | uint32_t{bytes[3]} << 24;
+}
+
+bool isCompatible(const std::vector<char> &data,
+                  const VkPhysicalDeviceProperties &properties) {
+  if (data.size() < kHeaderSize) {
+    return false;
+  }
+  const uint32_t header_size = readUint32(&data[0]);
+  const uint32_t header_version = readUint32(&data[4]);
+  const uint32_t vendor_id = readUint32(&data[8]);
+  const uint32_t device_id = readUint32(&data[12]);
+  return header_size >= kHeaderSize && header_size <= data.size() &&
+         header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         vendor_id == properties.vendorID &&
+         device_id == properties.deviceID &&
+         std::memcmp(&data[16], properties.pipelineCacheUUID,
+                     VK_UUID_SIZE) == 0;
+}
+
+std::vector<char> loadCacheFile(const std::string &path) {
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open()) {
+    return {};
+  }
+  const std::streamoff length = file.tellg();
+  if (length <= 0) {
+    return {};
+  }
+  std::vector<char> data(static_cast<size_t>(length));
+  file.seekg(0);
+  if (!file.read(data.data(), length)) {
+    return {};
+  }
+  return data;
+}
+
+size_t hashData(const std::vector<char> &data) {
+  return std::hash<std::string_view>{}(
+      std::string_view(data.data(), data.size()));
+}
+} // namespace
+
+PipelineCache::PipelineCache(const VkDevice &device,
+                             const VkPhysicalDeviceProperties &properties,
+                             std::string path)
+    : path_(std::move(path)), last_save_(std::chrono::steady_clock::now()) {
+  std::vector<char> data;
+  if (!path_.empty()) {
+    data = loadCacheFile(path_);
+    if (!data.empty() && !isCompatible(data, properties)) {
+      std::clog << "discarding incompatible pipeline cache " << path_
+                << std::endl;
+      data.clear();
+    }
+  }
+  saved_hash_ = hashData(data);
+
+  VkPipelineCacheCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+  if (vkCreatePipelineCache(device, &info, nullptr, &cache_) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache!");
+  }
+}
+
+void PipelineCache::save(const VkDevice &device) {
+  last_save_ = std::chrono::steady_clock::now();
+  if (path_.empty()) {
+    return;
+  }
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache_, &size, nullptr) != VK_SUCCESS) {
+    return;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache_, &size, data.data()) !=
+      VK_SUCCESS) {
+    return;
+  }
+  data.resize(size);
+  const size_t hash = hashData(data);
+  if (hash == saved_hash_) {
+    return;
+  }
+
+  const std::string temporary_path = path_ + ".tmp";
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), data.size())) {
+      std::clog << "failed to write pipeline cache " << temporary_path
+                << std::endl;
+      return;
+    }
+  }
+  if (std::rename(temporary_path.c_str(), path_.c_str()) != 0) {
+    std::clog << "failed to replace pipeline cache " << path_ << std::endl;
+    std::remove(temporary_path.c_str());
+    return;
+  }
+  saved_hash_ = hash;
+}
+
+void PipelineCache::saveIfDue(const VkDevice &device,
+                              std::chrono::seconds interval) {
+  if (std::chrono::steady_clock::now() - last_save_ >= interval) {
+    save(device);
+  }
+}
+
+void PipelineCache::destroy(const VkDevice &device) {
+  vkDestroyPipelineCache(device, cache_, nullptr);
+}
+} // namespace cg
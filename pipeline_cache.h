@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+namespace cg {
+// A VkPipelineCache persisted to disk between runs. Data written by a
+// different driver or device is detected from the cache header and
+// discarded instead of being handed to the driver.
+class PipelineCache {
+public:
+  // An empty path keeps the cache in memory only.
+  PipelineCache(const VkDevice &device,
+                const VkPhysicalDeviceProperties &properties,
+                std::string path);
+
+  VkPipelineCache handle() const { return cache_; }
+
+  // Writes the cache to a temporary file and renames it over the old one, so
+  // a crash mid-write never leaves a truncated cache behind. Skipped when
+  // nothing changed since the last save.
+  void save(const VkDevice &device);
+  // Saves if at least interval has passed since the last save.
+  void saveIfDue(const VkDevice &device, std::chrono::seconds interval);
+
+  void destroy(const VkDevice &device);
+
+private:
+  std::string path_;
+  VkPipelineCache cache_ = VK_NULL_HANDLE;
+  size_t saved_hash_ = 0;
+  std::chrono::steady_clock::time_point last_save_;
+};
+} // namespace cg
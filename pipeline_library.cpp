@@ -0,0 +1,446 @@
+#include "pipeline_library.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "hash.h"
+#include "shader/shader_utils.h"
+
+namespace cg {
+namespace {
+// Leaves out the fragment stage if fragment is VK_NULL_HANDLE.
+std::vector<VkPipelineShaderStageCreateInfo>
+getPipelineShaderStageCreateInfos(const VkShaderModule &vertex,
+                                  const VkShaderModule &fragment) {
+  std::vector<VkPipelineShaderStageCreateInfo> infos;
+  {
+    VkPipelineShaderStageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    info.module = vertex;
+    info.pName = "main";
+    infos.emplace_back(info);
+  }
+  if (fragment != VK_NULL_HANDLE) {
+    VkPipelineShaderStageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    info.module = fragment;
+    info.pName = "main";
+    infos.emplace_back(info);
+  }
+  return infos;
+}
+
+VkPipelineVertexInputStateCreateInfo
+getPipelineVertexInputStateCreateInfo(const PipelineKey &key) {
+  VkPipelineVertexInputStateCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  info.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(key.bindings.size());
+  info.pVertexBindingDescriptions = key.bindings.data();
+  info.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(key.attributes.size());
+  info.pVertexAttributeDescriptions = key.attributes.data();
+  return info;
+}
+
+VkPipelineInputAssemblyStateCreateInfo
+getPipelineInputAssemblyStateCreateInfo(const PipelineKey &key) {
+  VkPipelineInputAssemblyStateCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  info.topology = key.topology;
+  info.primitiveRestartEnable = VK_FALSE;
+  return info;
+}
+
+VkViewport getViewport(const VkExtent2D &extent) {
+  VkViewport viewport{};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = (float)extent.width;
+  viewport.height = (float)extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  return viewport;
+}
+
+VkRect2D getScissor(const VkExtent2D &extent) {
+  VkRect2D scissor{};
+  scissor.offset = {0, 0};
+  scissor.extent = extent;
+  return scissor;
+}
+
+// Only the counts; the rectangles themselves are dynamic state.
+VkPipelineViewportStateCreateInfo getViewportState() {
+  VkPipelineViewportStateCreateInfo state{};
+  state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  state.viewportCount = 1;
+  state.pViewports = nullptr;
+  state.scissorCount = 1;
+  state.pScissors = nullptr;
+  return state;
+}
+
+VkPipelineRasterizationStateCreateInfo getRasterizer(const PipelineKey &key) {
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = key.polygon_mode;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = key.cull_mode;
+  rasterizer.frontFace = key.front_face;
+  rasterizer.depthBiasEnable = key.depth_bias ? VK_TRUE : VK_FALSE;
+  rasterizer.depthBiasConstantFactor = 0.0f;
+  rasterizer.depthBiasClamp = 0.0f;
+  rasterizer.depthBiasSlopeFactor = 0.0f;
+  return rasterizer;
+}
+
+VkPipelineMultisampleStateCreateInfo getMultisampling(const PipelineKey &key) {
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  multisampling.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = key.samples;
+  multisampling.minSampleShading = 1.0f;
+  multisampling.pSampleMask = nullptr;
+  multisampling.alphaToCoverageEnable = VK_FALSE;
+  multisampling.alphaToOneEnable = VK_FALSE;
+  return multisampling;
+}
+
+// Straight alpha blending when the key asks for blending.
+VkPipelineColorBlendAttachmentState
+getColorBlendAttachment(const PipelineKey &key) {
+  VkPipelineColorBlendAttachmentState blend{};
+  blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  blend.blendEnable = key.blend ? VK_TRUE : VK_FALSE;
+  blend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blend.colorBlendOp = VK_BLEND_OP_ADD;
+  blend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  blend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blend.alphaBlendOp = VK_BLEND_OP_ADD;
+  return blend;
+}
+
+// attachment is nullptr for subpasses without color attachments.
+VkPipelineColorBlendStateCreateInfo
+getColorBlend(VkPipelineColorBlendAttachmentState *attachment) {
+  VkPipelineColorBlendStateCreateInfo color_blending{};
+  color_blending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blending.logicOpEnable = VK_FALSE;
+  color_blending.logicOp = VK_LOGIC_OP_COPY;
+  color_blending.attachmentCount = attachment ? 1 : 0;
+  color_blending.pAttachments = attachment;
+  color_blending.blendConstants[0] = 0.0f;
+  color_blending.blendConstants[1] = 0.0f;
+  color_blending.blendConstants[2] = 0.0f;
+  color_blending.blendConstants[3] = 0.0f;
+  return color_blending;
+}
+
+VkPipelineDepthStencilStateCreateInfo getDepthStencil(const PipelineKey &key) {
+  VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+  depth_stencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = key.depth_test ? VK_TRUE : VK_FALSE;
+  depth_stencil.depthWriteEnable = key.depth_write ? VK_TRUE : VK_FALSE;
+  depth_stencil.depthCompareOp = key.depth_compare;
+  depth_stencil.depthBoundsTestEnable = VK_FALSE;
+  depth_stencil.stencilTestEnable = VK_FALSE;
+  depth_stencil.minDepthBounds = 0.0f;
+  depth_stencil.maxDepthBounds = 1.0f;
+  return depth_stencil;
+}
+
+// State every pipeline leaves to the command buffer, so that neither the
+// render target size nor these raster parameters are part of a pipeline's
+// identity. Cull mode would need VK_EXT_extended_dynamic_state or Vulkan 1.3.
+std::vector<VkDynamicState> getDynamicStates() {
+  return {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
+          VK_DYNAMIC_STATE_LINE_WIDTH, VK_DYNAMIC_STATE_DEPTH_BIAS};
+}
+
+VkPipelineDynamicStateCreateInfo
+getDynamicStateCreateInfo(std::vector<VkDynamicState> &states) {
+  VkPipelineDynamicStateCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  info.dynamicStateCount = states.size();
+  info.pDynamicStates = states.data();
+  return info;
+}
+
+// Destroys the modules on every way out of createGraphicsPipeline(), so that
+// a shader that fails to load does not leak the other.
+struct ShaderModules {
+  VkDevice device;
+  VkShaderModule vertex = VK_NULL_HANDLE;
+  VkShaderModule fragment = VK_NULL_HANDLE;
+
+  explicit ShaderModules(VkDevice device) : device(device) {}
+  ShaderModules(const ShaderModules &) = delete;
+  ShaderModules &operator=(const ShaderModules &) = delete;
+  ~ShaderModules() {
+    vkDestroyShaderModule(device, fragment, nullptr);
+    vkDestroyShaderModule(device, vertex, nullptr);
+  }
+};
+
+} // namespace
+
+void PipelineKey::setVertexLayout(const VertexLayout &vertex_layout) {
+  bindings = vertex_layout.bindings();
+  attributes = vertex_layout.attributes();
+}
+
+bool PipelineKey::operator==(const PipelineKey &other) const {
+  auto same_bindings = [](const VkVertexInputBindingDescription &a,
+                          const VkVertexInputBindingDescription &b) {
+    return a.binding == b.binding && a.stride == b.stride &&
+           a.inputRate == b.inputRate;
+  };
+  auto same_attributes = [](const VkVertexInputAttributeDescription &a,
+                            const VkVertexInputAttributeDescription &b) {
+    return a.location == b.location && a.binding == b.binding &&
+           a.format == b.format && a.offset == b.offset;
+  };
+  return vertex_shader == other.vertex_shader &&
+         fragment_shader == other.fragment_shader &&
+         std::equal(bindings.begin(), bindings.end(), other.bindings.begin(),
+                    other.bindings.end(), same_bindings) &&
+         std::equal(attributes.begin(), attributes.end(),
+                    other.attributes.begin(), other.attributes.end(),
+                    same_attributes) &&
+         topology == other.topology && polygon_mode == other.polygon_mode &&
+         cull_mode == other.cull_mode && front_face == other.front_face &&
+         depth_bias == other.depth_bias && blend == other.blend &&
+         depth_test == other.depth_test && depth_write == other.depth_write &&
+         depth_compare == other.depth_compare && samples == other.samples &&
+         render_pass == other.render_pass && subpass == other.subpass &&
+         layout == other.layout;
+}
+
+size_t PipelineKeyHash::operator()(const PipelineKey &key) const {
+  size_t seed = 0;
+  hashCombine(seed, key.vertex_shader);
+  hashCombine(seed, key.fragment_shader);
+  for (const auto &binding : key.bindings) {
+    hashCombine(seed, binding.binding);
+    hashCombine(seed, binding.stride);
+    hashCombine(seed, static_cast<int>(binding.inputRate));
+  }
+  for (const auto &attribute : key.attributes) {
+    hashCombine(seed, attribute.location);
+    hashCombine(seed, attribute.binding);
+    hashCombine(seed, static_cast<int>(attribute.format));
+    hashCombine(seed, attribute.offset);
+  }
+  hashCombine(seed, static_cast<int>(key.topology));
+  hashCombine(seed, static_cast<int>(key.polygon_mode));
+  hashCombine(seed, key.cull_mode);
+  hashCombine(seed, static_cast<int>(key.front_face));
+  hashCombine(seed, key.depth_bias);
+  hashCombine(seed, key.blend);
+  hashCombine(seed, key.depth_test);
+  hashCombine(seed, key.depth_write);
+  hashCombine(seed, static_cast<int>(key.depth_compare));
+  hashCombine(seed, static_cast<int>(key.samples));
+  hashCombine(seed, reinterpret_cast<uintptr_t>(key.render_pass));
+  hashCombine(seed, key.subpass);
+  hashCombine(seed, reinterpret_cast<uintptr_t>(key.layout));
+  return seed;
+}
+
+void setDynamicState(VkCommandBuffer command_buffer, const VkExtent2D &extent) {
+  const VkViewport viewport = getViewport(extent);
+  const VkRect2D scissor = getScissor(extent);
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+  vkCmdSetLineWidth(command_buffer, 1.0f);
+  vkCmdSetDepthBias(command_buffer, 0.0f, 0.0f, 0.0f);
+}
+
+VkPipeline createGraphicsPipeline(const PipelineKey &key,
+                                  const VkPipelineCache &cache,
+                                  const VkDevice &device) {
+  VkGraphicsPipelineCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+  ShaderModules shaders(device);
+  shaders.vertex = createShaderModule(key.vertex_shader, device);
+  const bool depth_only = key.fragment_shader.empty();
+  if (!depth_only) {
+    shaders.fragment = createShaderModule(key.fragment_shader, device);
+  }
+  auto shader_stages =
+      getPipelineShaderStageCreateInfos(shaders.vertex, shaders.fragment);
+  info.stageCount = static_cast<uint32_t>(shader_stages.size());
+  info.pStages = shader_stages.data();
+
+  auto vertex_input_info = getPipelineVertexInputStateCreateInfo(key);
+  info.pVertexInputState = &vertex_input_info;
+
+  auto input_assembly = getPipelineInputAssemblyStateCreateInfo(key);
+  info.pInputAssemblyState = &input_assembly;
+
+  auto viewport_state = getViewportState();
+  info.pViewportState = &viewport_state;
+
+  auto rasterizer = getRasterizer(key);
+  info.pRasterizationState = &rasterizer;
+
+  auto multisampling = getMultisampling(key);
+  info.pMultisampleState = &multisampling;
+
+  auto depth_stencil = getDepthStencil(key);
+  const bool has_depth = key.depth_test || key.depth_write;
+  info.pDepthStencilState = has_depth ? &depth_stencil : nullptr;
+
+  auto color_blend_attachment = getColorBlendAttachment(key);
+  auto color_blending =
+      getColorBlend(depth_only ? nullptr : &color_blend_attachment);
+  info.pColorBlendState = &color_blending;
+
+  auto dynamic_states = getDynamicStates();
+  auto dynamic_state = getDynamicStateCreateInfo(dynamic_states);
+  info.pDynamicState = &dynamic_state;
+  info.layout = key.layout;
+  info.renderPass = key.render_pass;
+  info.subpass = key.subpass;
+  info.basePipelineHandle = VK_NULL_HANDLE;
+  info.basePipelineIndex = -1;
+
+  VkPipeline pipeline;
+  const VkResult result =
+      vkCreateGraphicsPipelines(device, cache, 1, &info, nullptr, &pipeline);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create graphics pipeline!");
+  }
+  return pipeline;
+}
+
+PipelineLibrary::PipelineLibrary(const VkDevice &device,
+                                 const VkPipelineCache &cache,
+                                 uint32_t thread_count)
+    : device_(device), cache_(cache) {
+  // Keys queued by get() would otherwise never compile.
+  if (thread_count == 0) {
+    throw std::runtime_error("pipeline compile threads must be non-zero!");
+  }
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&PipelineLibrary::workerLoop, this);
+  }
+}
+
+PipelineLibrary::~PipelineLibrary() { stop(); }
+
+VkPipeline PipelineLibrary::get(const PipelineKey &key, VkPipeline fallback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto [it, inserted] = pipelines_.try_emplace(key);
+  if (inserted) {
+    queue_.push_back(key);
+    work_ready_.notify_one();
+  }
+  return it->second.pipeline != VK_NULL_HANDLE ? it->second.pipeline
+                                               : fallback;
+}
+
+VkPipeline PipelineLibrary::getBlocking(const PipelineKey &key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto [it, inserted] = pipelines_.try_emplace(key);
+  // Unlike iterators, references to elements survive a rehash by get(), and
+  // entries are never erased before destroy().
+  Entry &entry = it->second;
+  if (!inserted) {
+    compiled_.wait(lock, [&] { return !entry.compiling; });
+    if (entry.pipeline == VK_NULL_HANDLE) {
+      throw std::runtime_error("failed to create graphics pipeline!");
+    }
+    return entry.pipeline;
+  }
+  lock.unlock();
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  try {
+    pipeline = createGraphicsPipeline(key, cache_, device_);
+  } catch (...) {
+    // As in workerLoop(), the failed entry stays so that it is not retried.
+    lock.lock();
+    entry.compiling = false;
+    compiled_.notify_all();
+    throw;
+  }
+  lock.lock();
+  entry.pipeline = pipeline;
+  entry.compiling = false;
+  compiled_.notify_all();
+  return pipeline;
+}
+
+uint64_t PipelineLibrary::generation() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+size_t PipelineLibrary::pendingCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const auto &[key, entry] : pipelines_) {
+    count += entry.compiling ? 1 : 0;
+  }
+  return count;
+}
+
+void PipelineLibrary::destroy() {
+  stop();
+  for (auto &[key, entry] : pipelines_) {
+    vkDestroyPipeline(device_, entry.pipeline, nullptr);
+  }
+  pipelines_.clear();
+}
+
+void PipelineLibrary::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void PipelineLibrary::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    const PipelineKey key = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    try {
+      pipeline = createGraphicsPipeline(key, cache_, device_);
+    } catch (const std::exception &e) {
+      // Keep drawing with the fallback rather than retrying every frame.
+      std::clog << "pipeline compilation failed: " << e.what() << std::endl;
+    }
+    lock.lock();
+    Entry &entry = pipelines_.at(key);
+    entry.pipeline = pipeline;
+    entry.compiling = false;
+    ++generation_;
+    compiled_.notify_all();
+  }
+}
+} // namespace cg
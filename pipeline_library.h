@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "mesh.h"
+
+namespace cg {
+// Everything that tells two graphics pipelines apart. State set by
+// setDynamicState() is deliberately not part of it. The render pass only
+// matters up to compatibility, but is keyed by handle.
+struct PipelineKey {
+  std::string vertex_shader = "shader.vert";
+  // Empty for depth-only pipelines, whose subpass has no color attachment.
+  std::string fragment_shader = "shader.frag";
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+  bool depth_bias = false;
+  bool blend = false;
+  bool depth_test = false;
+  bool depth_write = false;
+  VkCompareOp depth_compare = VK_COMPARE_OP_LESS_OR_EQUAL;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  uint32_t subpass = 0;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+
+  void setVertexLayout(const VertexLayout &vertex_layout);
+  bool operator==(const PipelineKey &other) const;
+  bool operator!=(const PipelineKey &other) const { return !(*this == other); }
+};
+
+struct PipelineKeyHash {
+  size_t operator()(const PipelineKey &key) const;
+};
+
+VkPipeline createGraphicsPipeline(const PipelineKey &key,
+                                  const VkPipelineCache &cache,
+                                  const VkDevice &device);
+
+// Sets the state every pipeline leaves dynamic. Needed in each command buffer
+// that draws, secondary ones included, as dynamic state is not inherited.
+void setDynamicState(VkCommandBuffer command_buffer, const VkExtent2D &extent);
+
+// Graphics pipelines by key. A miss in get() is compiled on a background
+// thread rather than stalling the recording thread; until it is ready the
+// caller draws with a fallback pipeline or skips the draw. thread_count must
+// be at least one.
+class PipelineLibrary {
+public:
+  PipelineLibrary(const VkDevice &device, const VkPipelineCache &cache,
+                  uint32_t thread_count);
+  ~PipelineLibrary();
+
+  PipelineLibrary(const PipelineLibrary &) = delete;
+  PipelineLibrary &operator=(const PipelineLibrary &) = delete;
+
+  // The pipeline for key, or fallback while it is compiling or if it failed
+  // to compile. The first call for a key queues its compilation.
+  VkPipeline get(const PipelineKey &key, VkPipeline fallback = VK_NULL_HANDLE);
+  // Compiles on the calling thread if needed, or waits for a background
+  // compilation already under way. Throws if compilation fails.
+  VkPipeline getBlocking(const PipelineKey &key);
+
+  // Bumped whenever a background compilation finishes, so that command
+  // buffers recorded with a fallback know to re-record.
+  uint64_t generation() const;
+  size_t pendingCount() const;
+
+  // Stops the compile threads and destroys every pipeline.
+  void destroy();
+
+private:
+  struct Entry {
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    bool compiling = true;
+  };
+
+  void stop();
+  void workerLoop();
+
+  VkDevice device_;
+  VkPipelineCache cache_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable compiled_;
+  std::unordered_map<PipelineKey, Entry, PipelineKeyHash> pipelines_;
+  std::deque<PipelineKey> queue_;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+} // namespace cg
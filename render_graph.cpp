@@ -0,0 +1,815 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "texture.h"
+
+namespace cg {
+namespace {
+constexpr VkAccessFlags kWriteAccess =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+struct UsageInfo {
+  VkPipelineStageFlags stages;
+  VkAccessFlags access;
+  // VK_IMAGE_LAYOUT_UNDEFINED for usages of buffers only.
+  VkImageLayout layout;
+  VkImageUsageFlags image_usage;
+  bool write;
+};
+
+UsageInfo getUsageInfo(ResourceUsage usage) {
+  constexpr VkPipelineStageFlags fragment_tests =
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  switch (usage) {
+  case ResourceUsage::kColorAttachment:
+    return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+  case ResourceUsage::kDepthAttachment:
+    return {fragment_tests,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true};
+  case ResourceUsage::kDepthRead:
+    return {fragment_tests, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false};
+  case ResourceUsage::kSampled:
+    return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_SAMPLED_BIT, false};
+  case ResourceUsage::kStorageRead:
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false};
+  case ResourceUsage::kStorageWrite:
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true};
+  case ResourceUsage::kTransferSrc:
+    return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+  case ResourceUsage::kTransferDst:
+    return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT, true};
+  case ResourceUsage::kIndirectRead:
+    return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0,
+            false};
+  case ResourceUsage::kVertexRead:
+    return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0,
+            false};
+  case ResourceUsage::kPresent:
+    return {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, false};
+  }
+  throw std::runtime_error("unknown resource usage!");
+}
+
+bool isBufferUsage(ResourceUsage usage) {
+  switch (usage) {
+  case ResourceUsage::kStorageRead:
+  case ResourceUsage::kStorageWrite:
+  case ResourceUsage::kTransferSrc:
+  case ResourceUsage::kTransferDst:
+  case ResourceUsage::kIndirectRead:
+  case ResourceUsage::kVertexRead:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isAttachment(ResourceUsage usage) {
+  return usage == ResourceUsage::kColorAttachment ||
+         usage == ResourceUsage::kDepthAttachment ||
+         usage == ResourceUsage::kDepthRead;
+}
+
+VkImageAspectFlags getAspectMask(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+// What the passes so far have done to a resource.
+struct ResourceState {
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  // The last write, or layout transition, and what has read since.
+  VkPipelineStageFlags write_stages = 0;
+  VkAccessFlags write_access = 0;
+  VkPipelineStageFlags read_stages = 0;
+  // Where the last write has been made visible.
+  VkPipelineStageFlags visible_stages = 0;
+  VkAccessFlags visible_access = 0;
+};
+} // namespace
+
+RenderGraph::RenderGraph(DeviceAllocator &allocator, uint32_t frame_count)
+    : allocator_(allocator), device_(allocator.device()),
+      frame_count_(frame_count) {}
+
+void RenderGraph::reset() {
+  retire();
+  resources_.clear();
+  passes_.clear();
+  final_barriers_ = {};
+  statistics_ = {};
+}
+
+RenderGraph::Resource
+RenderGraph::importImage(const std::string &name,
+                         const ImageDescription &description,
+                         VkPipelineStageFlags ready_stage,
+                         ResourceUsage final_usage) {
+  ResourceNode node;
+  node.name = name;
+  node.imported = true;
+  node.description = description;
+  node.ready_stage = ready_stage;
+  node.final_usage = final_usage;
+  resources_.push_back(node);
+  return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Resource
+RenderGraph::createImage(const std::string &name,
+                         const ImageDescription &description) {
+  ResourceNode node;
+  node.name = name;
+  node.description = description;
+  resources_.push_back(node);
+  return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string &name) {
+  ResourceNode node;
+  node.name = name;
+  node.image = false;
+  node.imported = true;
+  resources_.push_back(node);
+  return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string &name,
+                                       RecordFunction record,
+                                       VkSubpassContents contents) {
+  PassNode node;
+  node.name = name;
+  node.record = std::move(record);
+  node.contents = contents;
+  passes_.push_back(std::move(node));
+  return static_cast<Pass>(passes_.size() - 1);
+}
+
+void RenderGraph::use(Pass pass, Resource resource, ResourceUsage usage) {
+  auto &accesses = passes_[pass].accesses;
+  if (std::any_of(accesses.begin(), accesses.end(), [&](const Access &a) {
+        return a.resource == resource;
+      })) {
+    throw std::runtime_error("resource " + resources_[resource].name +
+                             " is used twice by pass " + passes_[pass].name +
+                             "!");
+  }
+  const bool image = resources_[resource].image;
+  if (image ? getUsageInfo(usage).layout == VK_IMAGE_LAYOUT_UNDEFINED
+            : !isBufferUsage(usage)) {
+    throw std::runtime_error("usage does not apply to resource " +
+                             resources_[resource].name + "!");
+  }
+  accesses.push_back({resource, usage});
+}
+
+void RenderGraph::addColorAttachment(Pass pass, Resource resource,
+                                     VkAttachmentLoadOp load_op,
+                                     VkClearColorValue clear) {
+  use(pass, resource, ResourceUsage::kColorAttachment);
+  passes_[pass].accesses.back().load = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+  VkClearValue clear_value{};
+  clear_value.color = clear;
+  passes_[pass].attachments.push_back({resource, load_op, clear_value, false});
+}
+
+void RenderGraph::setDepthAttachment(Pass pass, Resource resource,
+                                     VkAttachmentLoadOp load_op,
+                                     VkClearDepthStencilValue clear,
+                                     bool read_only) {
+  use(pass, resource,
+      read_only ? ResourceUsage::kDepthRead : ResourceUsage::kDepthAttachment);
+  passes_[pass].accesses.back().load = load_op == VK_ATTACHMENT_LOAD_OP_LOAD;
+  VkClearValue clear_value{};
+  clear_value.depthStencil = clear;
+  passes_[pass].attachments.push_back({resource, load_op, clear_value, true});
+}
+
+void RenderGraph::addResolveAttachment(Pass pass, Resource resource) {
+  auto &attachments = passes_[pass].attachments;
+  const uint32_t color_count = static_cast<uint32_t>(std::count_if(
+      attachments.begin(), attachments.end(), [](const Attachment &a) {
+        return !a.depth && !a.resolves.has_value();
+      }));
+  const auto color = std::find_if(
+      attachments.rbegin(), attachments.rend(),
+      [](const Attachment &a) { return !a.depth && !a.resolves.has_value(); });
+  if (color == attachments.rend() ||
+      resources_[color->resource].description.samples ==
+          VK_SAMPLE_COUNT_1_BIT ||
+      resources_[resource].description.samples != VK_SAMPLE_COUNT_1_BIT) {
+    throw std::runtime_error("pass " + passes_[pass].name +
+                             " has no multisampled color attachment to "
+                             "resolve into " +
+                             resources_[resource].name + "!");
+  }
+  if (std::any_of(attachments.begin(), attachments.end(),
+                  [&](const Attachment &a) {
+                    return a.resolves == color_count - 1;
+                  })) {
+    throw std::runtime_error("color attachment of pass " +
+                             passes_[pass].name + " is resolved twice!");
+  }
+  use(pass, resource, ResourceUsage::kColorAttachment);
+  attachments.push_back({resource, VK_ATTACHMENT_LOAD_OP_DONT_CARE, {},
+                         false, color_count - 1});
+}
+
+void RenderGraph::setSideEffects(Pass pass) {
+  passes_[pass].side_effects = true;
+}
+
+void RenderGraph::compile() {
+  retire();
+  statistics_ = {};
+  cullPasses();
+  allocateTransients();
+  computeBarriers();
+  createRenderPasses();
+
+  statistics_.pass_count = static_cast<uint32_t>(passes_.size());
+  statistics_.culled_pass_count = static_cast<uint32_t>(
+      std::count_if(passes_.begin(), passes_.end(),
+                    [](const PassNode &pass) { return !pass.kept; }));
+  statistics_.barrier_count = final_barriers_.empty() ? 0 : 1;
+  statistics_.image_barrier_count =
+      static_cast<uint32_t>(final_barriers_.images.size());
+  for (const auto &pass : passes_) {
+    if (pass.kept && !pass.barriers.empty()) {
+      ++statistics_.barrier_count;
+      statistics_.image_barrier_count +=
+          static_cast<uint32_t>(pass.barriers.images.size());
+    }
+  }
+}
+
+void RenderGraph::cullPasses() {
+  // Walking backwards, a pass is needed if it writes contents that a later
+  // needed pass reads or that outlive the frame. Attachments that are not
+  // loaded are overwritten, so earlier writes to them are not needed.
+  std::vector<bool> needed(resources_.size());
+  for (size_t i = 0; i < resources_.size(); ++i) {
+    needed[i] = resources_[i].imported;
+  }
+  for (auto pass = passes_.rbegin(); pass != passes_.rend(); ++pass) {
+    pass->kept = pass->side_effects;
+    for (const auto &access : pass->accesses) {
+      if (getUsageInfo(access.usage).write && needed[access.resource]) {
+        pass->kept = true;
+      }
+    }
+    if (!pass->kept) {
+      continue;
+    }
+    for (const auto &access : pass->accesses) {
+      const bool write = getUsageInfo(access.usage).write;
+      if (write && isAttachment(access.usage) && !access.load) {
+        needed[access.resource] = false;
+      }
+      if (!write || access.load) {
+        needed[access.resource] = true;
+      }
+    }
+  }
+}
+
+void RenderGraph::allocateTransients() {
+  struct Lifetime {
+    Resource resource;
+    uint32_t first_pass = UINT32_MAX;
+    uint32_t last_pass = 0;
+    VkImageUsageFlags usage = 0;
+    VkPipelineStageFlags stages = 0;
+    VkAccessFlags write_access = 0;
+    // Every use overwrites the image without reading it, so its contents
+    // never need memory beyond the tile of the pass writing them.
+    bool lazy = true;
+    VkMemoryRequirements requirements;
+  };
+  std::vector<Lifetime> lifetimes(resources_.size());
+  for (uint32_t i = 0; i < passes_.size(); ++i) {
+    if (!passes_[i].kept) {
+      continue;
+    }
+    for (const auto &access : passes_[i].accesses) {
+      const UsageInfo info = getUsageInfo(access.usage);
+      Lifetime &lifetime = lifetimes[access.resource];
+      lifetime.first_pass = std::min(lifetime.first_pass, i);
+      lifetime.last_pass = std::max(lifetime.last_pass, i);
+      lifetime.usage |= info.image_usage;
+      lifetime.stages |= info.stages;
+      lifetime.write_access |= info.access & kWriteAccess;
+      lifetime.lazy = lifetime.lazy && isAttachment(access.usage) &&
+                      info.write && !access.load;
+    }
+  }
+
+  std::vector<Lifetime> transients;
+  for (Resource r = 0; r < resources_.size(); ++r) {
+    ResourceNode &resource = resources_[r];
+    if (resource.imported || lifetimes[r].first_pass == UINT32_MAX) {
+      continue;
+    }
+    VkImageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = resource.description.format;
+    info.extent = {resource.description.extent.width,
+                   resource.description.extent.height, 1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = resource.description.samples;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage = lifetimes[r].usage;
+    if (lifetimes[r].lazy) {
+      info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device_, &info, nullptr, &resource.image_handle) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create transient image!");
+    }
+    transient_images_.push_back(resource.image_handle);
+    lifetimes[r].resource = r;
+    vkGetImageMemoryRequirements(device_, resource.image_handle,
+                                 &lifetimes[r].requirements);
+    transients.push_back(lifetimes[r]);
+  }
+
+  // Largest first, each image goes into the first memory slot it fits whose
+  // images are all dead before it is first used or born after it is last
+  // used.
+  std::stable_sort(transients.begin(), transients.end(),
+                   [](const Lifetime &a, const Lifetime &b) {
+                     return a.requirements.size > b.requirements.size;
+                   });
+  struct MemorySlot {
+    VkMemoryRequirements requirements;
+    bool lazy;
+    std::vector<const Lifetime *> images;
+  };
+  std::vector<MemorySlot> slots;
+  for (const auto &transient : transients) {
+    const VkMemoryRequirements &requirements = transient.requirements;
+    const auto slot = std::find_if(
+        slots.begin(), slots.end(), [&](const MemorySlot &slot) {
+          if (slot.lazy != transient.lazy ||
+              (slot.requirements.memoryTypeBits &
+               requirements.memoryTypeBits) == 0 ||
+              slot.requirements.size < requirements.size) {
+            return false;
+          }
+          return std::all_of(
+              slot.images.begin(), slot.images.end(),
+              [&](const Lifetime *other) {
+                return other->last_pass < transient.first_pass ||
+                       transient.last_pass < other->first_pass;
+              });
+        });
+    if (slot == slots.end()) {
+      slots.push_back({requirements, transient.lazy, {&transient}});
+      continue;
+    }
+    slot->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+    slot->requirements.alignment =
+        std::max(slot->requirements.alignment, requirements.alignment);
+    slot->images.push_back(&transient);
+  }
+
+  for (auto &slot : slots) {
+    const Allocation allocation = allocator_.allocate(
+        slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        slot.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0, false);
+    transient_memory_.push_back(allocation);
+    statistics_.transient_bytes += slot.requirements.size;
+    if (allocator_.memoryTypeFlags(allocation.memory_type) &
+        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+      statistics_.lazy_transient_bytes += slot.requirements.size;
+    }
+
+    // Each image first waits for the one before it in the slot, the first
+    // for the last one of the previous frame.
+    std::sort(slot.images.begin(), slot.images.end(),
+              [](const Lifetime *a, const Lifetime *b) {
+                return a->first_pass < b->first_pass;
+              });
+    for (size_t i = 0; i < slot.images.size(); ++i) {
+      const Lifetime &previous =
+          *slot.images[(i + slot.images.size() - 1) % slot.images.size()];
+      ResourceNode &resource = resources_[slot.images[i]->resource];
+      resource.alias_stages = previous.stages;
+      resource.alias_access = previous.write_access;
+      if (vkBindImageMemory(device_, resource.image_handle, allocation.memory,
+                            allocation.offset) != VK_SUCCESS) {
+        throw std::runtime_error("failed to bind transient image memory!");
+      }
+      resource.view = createImageView(
+          resource.image_handle, resource.description.format, device_,
+          getAspectMask(resource.description.format));
+      transient_views_.push_back(resource.view);
+      statistics_.unaliased_transient_bytes +=
+          slot.images[i]->requirements.size;
+    }
+  }
+}
+
+void RenderGraph::computeBarriers() {
+  std::vector<ResourceState> states(resources_.size());
+  for (size_t i = 0; i < resources_.size(); ++i) {
+    const ResourceNode &resource = resources_[i];
+    states[i].write_stages =
+        resource.imported ? resource.ready_stage : resource.alias_stages;
+    states[i].write_access = resource.imported ? 0 : resource.alias_access;
+  }
+
+  // Adds what resource needs before being used as info to batch. discard
+  // allows dropping the contents on a layout transition.
+  const auto transition = [&](BarrierBatch &batch, Resource resource,
+                              const UsageInfo &info, bool discard) {
+    ResourceState &state = states[resource];
+    const bool image = resources_[resource].image;
+    const bool layout_change = image && state.layout != info.layout;
+    if (info.write || layout_change) {
+      // Write-after-write and write-after-read; a layout transition is a
+      // write too.
+      const VkPipelineStageFlags src_stages =
+          state.write_stages | state.read_stages;
+      if (src_stages != 0 || layout_change) {
+        batch.src_stages |= src_stages;
+        batch.dst_stages |= info.stages;
+        if (image) {
+          batch.images.push_back(
+              {resource, discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout,
+               info.layout, state.write_access, info.access});
+        } else {
+          batch.src_access |= state.write_access;
+          batch.dst_access |= info.access;
+        }
+      }
+      state.layout = info.layout;
+      state.write_stages = info.stages;
+      state.write_access = info.access & kWriteAccess;
+      state.read_stages = info.write ? 0 : info.stages;
+      state.visible_stages = info.write ? 0 : info.stages;
+      state.visible_access = info.write ? 0 : info.access;
+      return;
+    }
+    // Read-after-write, unless an earlier barrier already made the write
+    // visible to this kind of read.
+    if (state.write_stages != 0 &&
+        ((info.stages & ~state.visible_stages) != 0 ||
+         (info.access & ~state.visible_access) != 0)) {
+      batch.src_stages |= state.write_stages;
+      batch.dst_stages |= info.stages;
+      if (image) {
+        batch.images.push_back({resource, state.layout, state.layout,
+                                state.write_access, info.access});
+      } else {
+        batch.src_access |= state.write_access;
+        batch.dst_access |= info.access;
+      }
+      state.visible_stages |= info.stages;
+      state.visible_access |= info.access;
+    }
+    state.read_stages |= info.stages;
+  };
+
+  for (auto &pass : passes_) {
+    pass.barriers = {};
+    if (!pass.kept) {
+      continue;
+    }
+    for (const auto &access : pass.accesses) {
+      const UsageInfo info = getUsageInfo(access.usage);
+      transition(pass.barriers, access.resource, info,
+                 isAttachment(access.usage) && info.write && !access.load);
+    }
+  }
+  for (Resource r = 0; r < resources_.size(); ++r) {
+    if (resources_[r].imported && resources_[r].image) {
+      transition(final_barriers_, r,
+                 getUsageInfo(resources_[r].final_usage), false);
+    }
+  }
+}
+
+void RenderGraph::createRenderPasses() {
+  for (uint32_t i = 0; i < passes_.size(); ++i) {
+    PassNode &pass = passes_[i];
+    pass.render_pass = VK_NULL_HANDLE;
+    if (!pass.kept || pass.attachments.empty()) {
+      continue;
+    }
+    pass.extent = resources_[pass.attachments[0].resource].description.extent;
+    for (const auto &attachment : pass.attachments) {
+      const VkExtent2D &extent =
+          resources_[attachment.resource].description.extent;
+      if (extent.width != pass.extent.width ||
+          extent.height != pass.extent.height) {
+        throw std::runtime_error("attachments of pass " + pass.name +
+                                 " differ in size!");
+      }
+    }
+    pass.render_pass = getRenderPass(i);
+  }
+}
+
+VkRenderPass RenderGraph::getRenderPass(Pass index) {
+  const PassNode &pass = passes_[index];
+  // An attachment is stored if it outlives the frame or a later pass reads
+  // it.
+  const auto stored = [&](Resource resource) {
+    if (resources_[resource].imported) {
+      return true;
+    }
+    for (uint32_t i = index + 1; i < passes_.size(); ++i) {
+      if (!passes_[i].kept) {
+        continue;
+      }
+      for (const auto &access : passes_[i].accesses) {
+        if (access.resource == resource &&
+            (!getUsageInfo(access.usage).write || access.load)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  std::vector<VkAttachmentDescription> descriptions;
+  std::vector<VkAttachmentReference> color_references;
+  std::vector<std::pair<uint32_t, VkAttachmentReference>> resolves;
+  std::optional<VkAttachmentReference> depth_reference;
+  std::vector<uint32_t> key;
+  for (const auto &attachment : pass.attachments) {
+    const ResourceNode &resource = resources_[attachment.resource];
+    const auto access =
+        std::find_if(pass.accesses.begin(), pass.accesses.end(),
+                     [&](const Access &access) {
+                       return access.resource == attachment.resource;
+                     });
+    const VkImageLayout layout = getUsageInfo(access->usage).layout;
+    VkAttachmentDescription description{};
+    description.format = resource.description.format;
+    description.samples = resource.description.samples;
+    description.loadOp = attachment.load_op;
+    description.storeOp = stored(attachment.resource)
+                              ? VK_ATTACHMENT_STORE_OP_STORE
+                              : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // The graph's barriers do the transitions.
+    description.initialLayout = layout;
+    description.finalLayout = layout;
+    const VkAttachmentReference reference{
+        static_cast<uint32_t>(descriptions.size()), layout};
+    if (attachment.depth) {
+      depth_reference = reference;
+    } else if (attachment.resolves) {
+      resolves.emplace_back(*attachment.resolves, reference);
+    } else {
+      color_references.push_back(reference);
+    }
+    descriptions.push_back(description);
+    // 0 for color, 1 for depth and 2 + i for the resolve of color i.
+    const uint32_t kind = attachment.depth       ? 1u
+                          : attachment.resolves ? *attachment.resolves + 2u
+                                                : 0u;
+    key.insert(key.end(),
+               {static_cast<uint32_t>(description.format),
+                static_cast<uint32_t>(description.samples),
+                static_cast<uint32_t>(description.loadOp),
+                static_cast<uint32_t>(description.storeOp),
+                static_cast<uint32_t>(layout), kind});
+  }
+  const auto found = render_passes_.find(key);
+  if (found != render_passes_.end()) {
+    return found->second;
+  }
+
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount =
+      static_cast<uint32_t>(color_references.size());
+  subpass.pColorAttachments = color_references.data();
+  std::vector<VkAttachmentReference> resolve_references;
+  if (!resolves.empty()) {
+    resolve_references.assign(
+        color_references.size(),
+        {VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED});
+    for (const auto &[color, reference] : resolves) {
+      resolve_references[color] = reference;
+    }
+    subpass.pResolveAttachments = resolve_references.data();
+  }
+  subpass.pDepthStencilAttachment =
+      depth_reference ? &*depth_reference : nullptr;
+  VkRenderPassCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  info.attachmentCount = static_cast<uint32_t>(descriptions.size());
+  info.pAttachments = descriptions.data();
+  info.subpassCount = 1;
+  info.pSubpasses = &subpass;
+  VkRenderPass render_pass;
+  if (vkCreateRenderPass(device_, &info, nullptr, &render_pass) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create render pass!");
+  }
+  render_passes_.emplace(key, render_pass);
+  return render_pass;
+}
+
+VkFramebuffer RenderGraph::getFramebuffer(const PassNode &pass) {
+  std::vector<VkImageView> views;
+  for (const auto &attachment : pass.attachments) {
+    views.push_back(resources_[attachment.resource].view);
+  }
+  auto &framebuffer = framebuffers_[{pass.render_pass, views}];
+  if (framebuffer != VK_NULL_HANDLE) {
+    return framebuffer;
+  }
+  VkFramebufferCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  info.renderPass = pass.render_pass;
+  info.attachmentCount = static_cast<uint32_t>(views.size());
+  info.pAttachments = views.data();
+  info.width = pass.extent.width;
+  info.height = pass.extent.height;
+  info.layers = 1;
+  if (vkCreateFramebuffer(device_, &info, nullptr, &framebuffer) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create framebuffer!");
+  }
+  return framebuffer;
+}
+
+void RenderGraph::beginFrame() {
+  for (auto it = retired_.begin(); it != retired_.end();) {
+    if (--it->frames_left > 0) {
+      ++it;
+      continue;
+    }
+    destroyRetired(*it);
+    it = retired_.erase(it);
+  }
+}
+
+void RenderGraph::bindImage(Resource resource, const VkImage &image,
+                            const VkImageView &view) {
+  if (!resources_[resource].imported || !resources_[resource].image) {
+    throw std::runtime_error("only imported images can be bound!");
+  }
+  resources_[resource].image_handle = image;
+  resources_[resource].view = view;
+}
+
+void RenderGraph::execute(VkCommandBuffer command_buffer,
+                          GpuProfiler *profiler) {
+  for (const auto &pass : passes_) {
+    if (!pass.kept) {
+      continue;
+    }
+    recordBarriers(command_buffer, pass.barriers);
+    const uint32_t scope =
+        profiler ? profiler->beginScope(command_buffer, pass.name.c_str())
+                 : GpuProfiler::kInvalidScope;
+    PassContext context;
+    if (pass.render_pass == VK_NULL_HANDLE) {
+      pass.record(command_buffer, context);
+    } else {
+      context = {pass.render_pass, getFramebuffer(pass), pass.extent};
+      std::vector<VkClearValue> clear_values;
+      for (const auto &attachment : pass.attachments) {
+        clear_values.push_back(attachment.clear);
+      }
+      VkRenderPassBeginInfo info{};
+      info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      info.renderPass = context.render_pass;
+      info.framebuffer = context.framebuffer;
+      info.renderArea.offset = {0, 0};
+      info.renderArea.extent = context.extent;
+      info.clearValueCount = static_cast<uint32_t>(clear_values.size());
+      info.pClearValues = clear_values.data();
+      vkCmdBeginRenderPass(command_buffer, &info, pass.contents);
+      pass.record(command_buffer, context);
+      vkCmdEndRenderPass(command_buffer);
+    }
+    if (profiler) {
+      profiler->endScope(command_buffer, scope);
+    }
+  }
+  recordBarriers(command_buffer, final_barriers_);
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer command_buffer,
+                                 const BarrierBatch &batch) const {
+  if (batch.empty()) {
+    return;
+  }
+  VkMemoryBarrier memory_barrier{};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask = batch.src_access;
+  memory_barrier.dstAccessMask = batch.dst_access;
+  const uint32_t memory_barrier_count =
+      batch.src_access != 0 || batch.dst_access != 0 ? 1 : 0;
+  std::vector<VkImageMemoryBarrier> image_barriers;
+  for (const auto &barrier : batch.images) {
+    const ResourceNode &resource = resources_[barrier.resource];
+    VkImageMemoryBarrier image_barrier = getLayoutBarrier(
+        resource.image_handle, barrier.old_layout, barrier.new_layout,
+        barrier.src_access, barrier.dst_access);
+    image_barrier.subresourceRange.aspectMask =
+        getAspectMask(resource.description.format);
+    image_barriers.push_back(image_barrier);
+  }
+  vkCmdPipelineBarrier(
+      command_buffer,
+      batch.src_stages != 0 ? batch.src_stages
+                            : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      batch.dst_stages != 0 ? batch.dst_stages
+                            : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0, memory_barrier_count, &memory_barrier, 0, nullptr,
+      static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+}
+
+void RenderGraph::retire() {
+  Retired retired;
+  for (const auto &[key, framebuffer] : framebuffers_) {
+    retired.framebuffers.push_back(framebuffer);
+  }
+  retired.views = std::move(transient_views_);
+  retired.images = std::move(transient_images_);
+  retired.allocations = std::move(transient_memory_);
+  retired.frames_left = frame_count_;
+  framebuffers_.clear();
+  transient_views_.clear();
+  transient_images_.clear();
+  transient_memory_.clear();
+  if (!retired.framebuffers.empty() || !retired.images.empty()) {
+    retired_.push_back(std::move(retired));
+  }
+}
+
+void RenderGraph::destroyRetired(Retired &retired) {
+  for (auto framebuffer : retired.framebuffers) {
+    vkDestroyFramebuffer(device_, framebuffer, nullptr);
+  }
+  for (auto view : retired.views) {
+    vkDestroyImageView(device_, view, nullptr);
+  }
+  for (auto image : retired.images) {
+    vkDestroyImage(device_, image, nullptr);
+  }
+  for (const auto &allocation : retired.allocations) {
+    allocator_.free(allocation);
+  }
+}
+
+void RenderGraph::destroy() {
+  retire();
+  for (auto &retired : retired_) {
+    destroyRetired(retired);
+  }
+  retired_.clear();
+  for (const auto &[key, render_pass] : render_passes_) {
+    vkDestroyRenderPass(device_, render_pass, nullptr);
+  }
+  render_passes_.clear();
+}
+} // namespace cg
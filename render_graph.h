@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "device_memory.h"
+#include "gpu_profiler.h"
+
+namespace cg {
+// How a pass uses a resource, which fixes the pipeline stages, access and,
+// for images, the layout the graph synchronizes it with.
+enum class ResourceUsage {
+  kColorAttachment,
+  kDepthAttachment,
+  // Read-only depth attachment, e.g. depth testing against a prepass.
+  kDepthRead,
+  // Sampled in the fragment shader.
+  kSampled,
+  // Storage image or buffer of a compute shader.
+  kStorageRead,
+  kStorageWrite,
+  kTransferSrc,
+  kTransferDst,
+  kIndirectRead,
+  kVertexRead,
+  kPresent,
+};
+
+struct ImageDescription {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {0, 0};
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+// What a pass's record function gets from the graph. Raster passes are
+// recorded inside their render pass, which secondary command buffers
+// inherit from.
+struct PassContext {
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  VkExtent2D extent = {0, 0};
+};
+
+struct RenderGraphStatistics {
+  uint32_t pass_count = 0;
+  uint32_t culled_pass_count = 0;
+  // vkCmdPipelineBarrier calls per execute(), after merging.
+  uint32_t barrier_count = 0;
+  uint32_t image_barrier_count = 0;
+  // Memory of the transient images with and without aliasing.
+  VkDeviceSize transient_bytes = 0;
+  VkDeviceSize unaliased_transient_bytes = 0;
+  // The part of transient_bytes in lazily allocated memory, which tile-based
+  // GPUs need never back.
+  VkDeviceSize lazy_transient_bytes = 0;
+};
+
+// A frame declared as passes and the resources they use. compile() works
+// out from the declarations:
+// - which passes contribute to an imported resource or have side effects;
+//   the others are culled;
+// - one merged pipeline barrier before each pass, covering every hazard and
+//   layout transition of its resources, and one after the last pass moving
+//   imported images to their final usage;
+// - a render pass and framebuffers for each pass with attachments, storing
+//   only attachments read later;
+// - memory for the transient images, where images whose lifetimes do not
+//   overlap share memory. Images whose contents never outlive a pass are
+//   transient attachments in lazily allocated memory where available.
+// Passes run in declaration order. Buffers are tracked only to synchronize
+// them, with global memory barriers, so they need no binding; their first
+// use in a frame waits for nothing, as for per-frame-slot buffers. Not
+// thread-safe.
+class RenderGraph {
+public:
+  using Resource = uint32_t;
+  using Pass = uint32_t;
+  using RecordFunction =
+      std::function<void(VkCommandBuffer, const PassContext &)>;
+
+  RenderGraph(DeviceAllocator &allocator, uint32_t frame_count);
+
+  // Forgets every pass and resource so the graph can be declared anew.
+  // Resources of the previous compile() are destroyed by beginFrame() once
+  // the frames using them have completed; render passes are kept, so equal
+  // attachments give pipelines compatible handles again.
+  void reset();
+
+  // An image owned outside the graph, bound per frame with bindImage(). Its
+  // contents are discarded at the start of the frame once ready_stage may
+  // proceed, e.g. the stage a swapchain acquire semaphore is waited at.
+  Resource importImage(const std::string &name,
+                       const ImageDescription &description,
+                       VkPipelineStageFlags ready_stage,
+                       ResourceUsage final_usage);
+  // An image owned by the graph, valid only within the frame.
+  Resource createImage(const std::string &name,
+                       const ImageDescription &description);
+  Resource importBuffer(const std::string &name);
+
+  Pass addPass(const std::string &name, RecordFunction record,
+               VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+  // Declares a non-attachment use; a resource may be used once per pass.
+  void use(Pass pass, Resource resource, ResourceUsage usage);
+  // Attachments are bound in the order they are added. A loaded attachment
+  // also reads the image.
+  void addColorAttachment(Pass pass, Resource resource,
+                          VkAttachmentLoadOp load_op,
+                          VkClearColorValue clear = {});
+  void setDepthAttachment(Pass pass, Resource resource,
+                          VkAttachmentLoadOp load_op,
+                          VkClearDepthStencilValue clear = {1.0f, 0},
+                          bool read_only = false);
+  // Resolves the multisampled color attachment added last into resource at
+  // the end of the pass.
+  void addResolveAttachment(Pass pass, Resource resource);
+  // Keeps the pass even though nothing in the graph reads its results.
+  void setSideEffects(Pass pass);
+
+  void compile();
+  bool isCulled(Pass pass) const { return !passes_[pass].kept; }
+  // VK_NULL_HANDLE for passes without attachments.
+  VkRenderPass renderPass(Pass pass) const {
+    return passes_[pass].render_pass;
+  }
+  RenderGraphStatistics statistics() const { return statistics_; }
+
+  // Destroys what earlier compilations left behind once every frame slot
+  // has come around since; call once per submitted frame, after waiting on
+  // the slot's fence.
+  void beginFrame();
+  void bindImage(Resource resource, const VkImage &image,
+                 const VkImageView &view);
+  // Records every pass that was not culled, each in a GPU scope of its name
+  // if profiler is given.
+  void execute(VkCommandBuffer command_buffer,
+               GpuProfiler *profiler = nullptr);
+
+  // The device must be idle.
+  void destroy();
+
+private:
+  struct ResourceNode {
+    std::string name;
+    bool image = true;
+    bool imported = false;
+    ImageDescription description;
+    VkPipelineStageFlags ready_stage = 0;
+    ResourceUsage final_usage = ResourceUsage::kPresent;
+    // Bound or, for transient images, created by compile().
+    VkImage image_handle = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    // Transient images only: how the previous image in the same memory was
+    // used, which the first use has to wait for.
+    VkPipelineStageFlags alias_stages = 0;
+    VkAccessFlags alias_access = 0;
+  };
+
+  struct Access {
+    Resource resource;
+    ResourceUsage usage;
+    // Also reads the previous contents.
+    bool load = false;
+  };
+
+  struct Attachment {
+    Resource resource;
+    VkAttachmentLoadOp load_op;
+    VkClearValue clear;
+    bool depth;
+    // For resolve attachments, the index among the color attachments of the
+    // one resolved.
+    std::optional<uint32_t> resolves;
+  };
+
+  struct ImageBarrier {
+    Resource resource;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkAccessFlags src_access;
+    VkAccessFlags dst_access;
+  };
+
+  // Everything recorded as one vkCmdPipelineBarrier.
+  struct BarrierBatch {
+    VkPipelineStageFlags src_stages = 0;
+    VkPipelineStageFlags dst_stages = 0;
+    VkAccessFlags src_access = 0;
+    VkAccessFlags dst_access = 0;
+    std::vector<ImageBarrier> images;
+
+    bool empty() const { return src_stages == 0 && dst_stages == 0; }
+  };
+
+  struct PassNode {
+    std::string name;
+    RecordFunction record;
+    VkSubpassContents contents;
+    std::vector<Access> accesses;
+    std::vector<Attachment> attachments;
+    bool side_effects = false;
+    // Set by compile().
+    bool kept = false;
+    BarrierBatch barriers;
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    VkExtent2D extent = {0, 0};
+  };
+
+  // Resources of a compilation awaiting destruction.
+  struct Retired {
+    std::vector<VkFramebuffer> framebuffers;
+    std::vector<VkImageView> views;
+    std::vector<VkImage> images;
+    std::vector<Allocation> allocations;
+    uint32_t frames_left;
+  };
+
+  void cullPasses();
+  void allocateTransients();
+  void computeBarriers();
+  void createRenderPasses();
+  VkRenderPass getRenderPass(Pass pass);
+  VkFramebuffer getFramebuffer(const PassNode &pass);
+  void recordBarriers(VkCommandBuffer command_buffer,
+                      const BarrierBatch &batch) const;
+  void retire();
+  void destroyRetired(Retired &retired);
+
+  DeviceAllocator &allocator_;
+  VkDevice device_;
+  uint32_t frame_count_;
+
+  std::vector<ResourceNode> resources_;
+  std::vector<PassNode> passes_;
+  BarrierBatch final_barriers_;
+  RenderGraphStatistics statistics_;
+
+  // Owned by the current compilation.
+  std::vector<VkImage> transient_images_;
+  std::vector<VkImageView> transient_views_;
+  std::vector<Allocation> transient_memory_;
+  std::map<std::pair<VkRenderPass, std::vector<VkImageView>>, VkFramebuffer>
+      framebuffers_;
+
+  std::vector<Retired> retired_;
+  // Keyed by the attachment descriptions.
+  std::map<std::vector<uint32_t>, VkRenderPass> render_passes_;
+};
+} // namespace cg
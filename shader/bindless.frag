@@ -0,0 +1,24 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct Material {
+  vec4 color;
+  uint texture;
+};
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+layout(std430, set = 1, binding = 1) readonly buffer Materials {
+  Material materials[];
+};
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragMaterial;
+layout(location = 0) out vec4 outColor;
+
+void main() {
+  Material material = materials[fragMaterial];
+  vec4 texel = texture(textures[nonuniformEXT(material.texture)], fragUv);
+  outColor = vec4(fragColor, 1.0) * material.color * texel;
+}
@@ -0,0 +1,51 @@
+# Writes OUTPUT, a C++ source that compiles every SPIR-V binary listed in
+# SPIRV_FILES (comma separated) into a uint32_t array and defines
+# cg::findEmbeddedShader() to look them up by shader name, e.g. "shader.vert".
+string(REPLACE "," ";" SPIRV_FILES "${SPIRV_FILES}")
+
+set(ARRAYS "")
+set(ENTRIES "")
+set(INDEX 0)
+foreach(SPIRV ${SPIRV_FILES})
+  get_filename_component(FILE_NAME ${SPIRV} NAME)
+  string(REGEX REPLACE "\\.spv$" "" SHADER_NAME ${FILE_NAME})
+  file(READ ${SPIRV} HEX HEX)
+  string(LENGTH "${HEX}" HEX_LENGTH)
+  math(EXPR REMAINDER "${HEX_LENGTH} % 8")
+  if(HEX_LENGTH EQUAL 0 OR NOT REMAINDER EQUAL 0)
+    message(FATAL_ERROR "${SPIRV} is not a whole number of SPIR-V words")
+  endif()
+  # SPIR-V words are little-endian on disk.
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u," WORDS "${HEX}")
+  string(REGEX REPLACE "((0x........u,){6})" "\\1\n    " WORDS "${WORDS}")
+  string(APPEND ARRAYS
+    "constexpr uint32_t kShader${INDEX}[] = {\n    ${WORDS}};\n")
+  string(APPEND ENTRIES
+    "    {\"${SHADER_NAME}\", kShader${INDEX}, std::size(kShader${INDEX})},\n")
+  math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+file(WRITE ${OUTPUT}.tmp
+"// Generated by embed_spirv.cmake; do not edit.
+#include \"shader/shader_utils.h\"
+
+#include <iterator>
+
+namespace cg {
+namespace {
+${ARRAYS}
+constexpr EmbeddedShader kEmbeddedShaders[] = {
+${ENTRIES}};
+} // namespace
+
+const EmbeddedShader *findEmbeddedShader(const std::string &name) {
+  for (const auto &shader : kEmbeddedShaders) {
+    if (name == shader.name) {
+      return &shader;
+    }
+  }
+  return nullptr;
+}
+} // namespace cg
+")
+configure_file(${OUTPUT}.tmp ${OUTPUT} COPYONLY)
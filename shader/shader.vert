@@ -1,21 +1,39 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(location = 0) out vec3 fragColor;
+layout(set = 0, binding = 0) uniform Frame {
+  vec4 view;
+  vec2 view_translation;
+} frame;
+
+// Per-draw data, for shaders that index per-mesh or per-batch resources.
+layout(push_constant) uniform Draw {
+  uint mesh;
+  uint batch;
+} draw;
 
-vec2 positions[3] = vec2[](
-  vec2(0.0, -0.5),
-  vec2(0.5, 0.5),
-  vec2(-0.5, 0.5)
-);
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec4 inTransform;
+layout(location = 3) in vec2 inTranslation;
+layout(location = 4) in vec4 inTint;
+layout(location = 5) in uint inMaterial;
+layout(location = 6) in float inDepth;
+
+layout(location = 0) out vec3 fragColor;
+// Only read by bindless.frag.
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragMaterial;
 
-vec3 colors[3] = vec3[](
-  vec3(1.0, 0.0, 0.0),
-  vec3(0.0, 1.0, 0.0),
-  vec3(0.0, 0.0, 1.0)
-);
+// The depth prepass and the main pass must produce identical depths.
+invariant gl_Position;
 
 void main() {
-  gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-  fragColor = colors[gl_VertexIndex];
+  mat2 transform = mat2(inTransform.xy, inTransform.zw);
+  vec2 world = transform * inPosition + inTranslation;
+  mat2 view = mat2(frame.view.xy, frame.view.zw);
+  gl_Position = vec4(view * world + frame.view_translation, inDepth, 1.0);
+  fragColor = inColor * inTint.rgb;
+  fragUv = inPosition + 0.5;
+  fragMaterial = inMaterial;
 }
@@ -0,0 +1,80 @@
+#include "shader/shader_utils.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace cg {
+namespace {
+std::string &shaderOverrideDirectory() {
+  static std::string directory = [] {
+    const char *value = std::getenv("CG_SHADER_DIR");
+    return std::string(value != nullptr ? value : "");
+  }();
+  return directory;
+}
+} // namespace
+
+std::vector<char> readFile(const std::string &filename) {
+  std::ifstream file(filename, std::ios::ate | std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("file " + filename + " not found");
+  }
+  const std::streamoff length = file.tellg();
+  if (length < 0) {
+    throw std::runtime_error("failed to determine size of " + filename);
+  }
+  std::vector<char> buffer(static_cast<size_t>(length));
+  file.seekg(0);
+  if (!file.read(buffer.data(), length)) {
+    throw std::runtime_error("failed to read " + filename);
+  }
+  return buffer;
+}
+
+void setShaderOverrideDirectory(const std::string &directory) {
+  shaderOverrideDirectory() = directory;
+}
+
+VkShaderModule createShaderModule(const uint32_t *code, size_t word_count,
+                                  VkDevice device) {
+  VkShaderModuleCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  info.codeSize = word_count * sizeof(uint32_t);
+  info.pCode = code;
+
+  VkShaderModule shader_module;
+  if (vkCreateShaderModule(device, &info, nullptr, &shader_module) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create shader module!");
+  }
+  return shader_module;
+}
+
+VkShaderModule createShaderModule(const std::vector<char> &code,
+                                  VkDevice device) {
+  if (code.empty() || code.size() % sizeof(uint32_t) != 0) {
+    throw std::runtime_error("SPIR-V size is not a multiple of 4 bytes!");
+  }
+  // std::vector<char> storage is not guaranteed to be 4-byte aligned.
+  std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+  std::memcpy(words.data(), code.data(), code.size());
+  return createShaderModule(words.data(), words.size(), device);
+}
+
+VkShaderModule createShaderModule(const std::string &source_filename,
+                                  VkDevice device) {
+  const std::string &directory = shaderOverrideDirectory();
+  if (!directory.empty()) {
+    const std::vector<char> code =
+        readFile(directory + '/' + source_filename + ".spv");
+    return createShaderModule(code, device);
+  }
+  const EmbeddedShader *shader = findEmbeddedShader(source_filename);
+  if (shader == nullptr) {
+    throw std::runtime_error("shader " + source_filename + " not embedded");
+  }
+  return createShaderModule(shader->code, shader->word_count, device);
+}
+} // namespace cg
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -7,8 +9,28 @@
 #include <GLFW/glfw3.h>
 
 namespace cg {
+// SPIR-V compiled into the binary by the shaders target.
+struct EmbeddedShader {
+  const char *name;
+  const uint32_t *code;
+  size_t word_count;
+};
+
 std::vector<char> readFile(const std::string &filename);
 
+// Returns the embedded SPIR-V for a shader source name such as "shader.vert",
+// or nullptr if there is none.
+const EmbeddedShader *findEmbeddedShader(const std::string &name);
+
+// Makes createShaderModule(source_filename, ...) read <directory>/<name>.spv
+// instead of the embedded SPIR-V, for iterating on shaders without
+// relinking. An empty directory restores the embedded shaders. Defaults to
+// the CG_SHADER_DIR environment variable.
+void setShaderOverrideDirectory(const std::string &directory);
+
+VkShaderModule createShaderModule(const uint32_t *code, size_t word_count,
+                                  VkDevice device);
+
 VkShaderModule createShaderModule(const std::vector<char> &code,
                                   VkDevice device);
 
@@ -0,0 +1,164 @@
+#include "texture.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "hash.h"
+
+namespace cg {
+VkImageView createImageView(const VkImage &image, VkFormat format,
+                            const VkDevice &device, VkImageAspectFlags aspect,
+                            uint32_t base_mip, uint32_t mip_count) {
+  VkImageViewCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  info.image = image;
+  info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  info.format = format;
+  info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.subresourceRange = {aspect, base_mip, mip_count, 0, 1};
+  VkImageView view;
+  if (vkCreateImageView(device, &info, nullptr, &view) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create image view!");
+  }
+  return view;
+}
+
+VkImageMemoryBarrier getLayoutBarrier(const VkImage &image,
+                                      VkImageLayout old_layout,
+                                      VkImageLayout new_layout,
+                                      VkAccessFlags src_access,
+                                      VkAccessFlags dst_access,
+                                      uint32_t mip_count) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_count, 0, 1};
+  return barrier;
+}
+
+Texture createTextureImage(DeviceAllocator &allocator, uint32_t width,
+                           uint32_t height, uint32_t mip_levels,
+                           VkImageUsageFlags usage) {
+  const VkDevice &device = allocator.device();
+  Texture texture;
+  texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+  texture.width = width;
+  texture.height = height;
+  texture.mip_levels = mip_levels;
+
+  VkImageCreateInfo image_info{};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = texture.format;
+  image_info.extent = {width, height, 1};
+  image_info.mipLevels = mip_levels;
+  image_info.arrayLayers = 1;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage = usage;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage(device, &image_info, nullptr, &texture.image) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create texture image!");
+  }
+  texture.allocation = allocator.allocateForImage(
+      texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  return texture;
+}
+
+Texture createTexture(DeviceAllocator &allocator, uint32_t width,
+                      uint32_t height, const void *pixels,
+                      const QueueContext &graphics) {
+  const VkDevice &device = allocator.device();
+  Texture texture = createTextureImage(
+      allocator, width, height, 1,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+
+  const VkDeviceSize size = VkDeviceSize{width} * height * 4;
+  Buffer staging = createBuffer(allocator, size,
+                                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  std::memcpy(staging.allocation.mapped, pixels, size);
+  allocator.flush(staging.allocation);
+
+  VkCommandBuffer command_buffer =
+      beginSingleTimeCommands(graphics.pool, device);
+  VkImageMemoryBarrier barrier = getLayoutBarrier(
+      texture.image, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  VkBufferImageCopy region{};
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {width, height, 1};
+  vkCmdCopyBufferToImage(command_buffer, staging.buffer, texture.image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+  barrier = getLayoutBarrier(texture.image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_ACCESS_SHADER_READ_BIT);
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                       0, nullptr, 1, &barrier);
+  endSingleTimeCommands(command_buffer, graphics.pool, graphics.queue, device);
+  staging.destroy(allocator);
+
+  texture.view = createImageView(texture.image, texture.format, device);
+  return texture;
+}
+
+bool SamplerKey::operator==(const SamplerKey &other) const {
+  return filter == other.filter && mipmap_mode == other.mipmap_mode &&
+         address_mode == other.address_mode && max_lod == other.max_lod;
+}
+
+size_t SamplerCache::KeyHash::operator()(const SamplerKey &key) const {
+  size_t seed = 0;
+  hashCombine(seed, static_cast<int>(key.filter));
+  hashCombine(seed, static_cast<int>(key.mipmap_mode));
+  hashCombine(seed, static_cast<int>(key.address_mode));
+  hashCombine(seed, key.max_lod);
+  return seed;
+}
+
+VkSampler SamplerCache::get(const SamplerKey &key) {
+  auto it = samplers_.find(key);
+  if (it != samplers_.end()) {
+    return it->second;
+  }
+  VkSamplerCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  info.magFilter = key.filter;
+  info.minFilter = key.filter;
+  info.mipmapMode = key.mipmap_mode;
+  info.addressModeU = key.address_mode;
+  info.addressModeV = key.address_mode;
+  info.addressModeW = key.address_mode;
+  info.maxLod = key.max_lod;
+  VkSampler sampler;
+  if (vkCreateSampler(device_, &info, nullptr, &sampler) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create texture sampler!");
+  }
+  samplers_.emplace(key, sampler);
+  return sampler;
+}
+
+void SamplerCache::destroy() {
+  for (const auto &[key, sampler] : samplers_) {
+    vkDestroySampler(device_, sampler, nullptr);
+  }
+  samplers_.clear();
+}
+} // namespace cg
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "buffer.h"
+#include "device_memory.h"
+
+namespace cg {
+// A sampled 2D image in SHADER_READ_ONLY_OPTIMAL layout. width and height are
+// those of its first mip level.
+struct Texture {
+  VkImage image = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkImageView view = VK_NULL_HANDLE;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t mip_levels = 1;
+
+  void destroy(DeviceAllocator &allocator) {
+    const VkDevice &device = allocator.device();
+    vkDestroyImageView(device, view, nullptr);
+    vkDestroyImage(device, image, nullptr);
+    allocator.free(allocation);
+  }
+};
+
+// A 2D view of mip_count levels of image, starting at base_mip.
+VkImageView
+createImageView(const VkImage &image, VkFormat format, const VkDevice &device,
+                VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+                uint32_t base_mip = 0, uint32_t mip_count = 1);
+
+// Barrier moving the first mip_count levels of a color image between
+// layouts.
+VkImageMemoryBarrier getLayoutBarrier(const VkImage &image,
+                                      VkImageLayout old_layout,
+                                      VkImageLayout new_layout,
+                                      VkAccessFlags src_access,
+                                      VkAccessFlags dst_access,
+                                      uint32_t mip_count = 1);
+
+// Creates a device-local RGBA8 image of mip_levels levels without contents
+// or a view.
+Texture createTextureImage(DeviceAllocator &allocator, uint32_t width,
+                           uint32_t height, uint32_t mip_levels,
+                           VkImageUsageFlags usage);
+
+// Creates a device-local RGBA8 texture from tightly packed pixels and waits
+// for the upload on the graphics queue.
+Texture createTexture(DeviceAllocator &allocator, uint32_t width,
+                      uint32_t height, const void *pixels,
+                      const QueueContext &graphics);
+
+// Sampler state that tells two samplers apart.
+struct SamplerKey {
+  VkFilter filter = VK_FILTER_LINEAR;
+  VkSamplerMipmapMode mipmap_mode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  VkSamplerAddressMode address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  float max_lod = VK_LOD_CLAMP_NONE;
+
+  bool operator==(const SamplerKey &other) const;
+};
+
+// Deduplicates samplers by their state. Devices may only create
+// maxSamplerAllocationCount samplers, so textures share them through here
+// instead of creating their own.
+class SamplerCache {
+public:
+  explicit SamplerCache(const VkDevice &device) : device_(device) {}
+
+  // Owned by the cache.
+  VkSampler get(const SamplerKey &key = {});
+  void destroy();
+
+private:
+  struct KeyHash {
+    size_t operator()(const SamplerKey &key) const;
+  };
+
+  VkDevice device_;
+  std::unordered_map<SamplerKey, VkSampler, KeyHash> samplers_;
+};
+} // namespace cg
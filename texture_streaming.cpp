@@ -0,0 +1,547 @@
+#include "texture_streaming.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "mapped_file.h"
+
+namespace cg {
+namespace {
+// Dimensions beyond any device's maxImageDimension2D, rejected before they
+// can overflow size computations.
+constexpr uint32_t kMaxImageSize = 1u << 15;
+
+uint32_t levelExtent(uint32_t size, uint32_t level) {
+  return std::max(1u, size >> level);
+}
+
+VkDeviceSize levelBytes(uint32_t width, uint32_t height, uint32_t level) {
+  return VkDeviceSize{levelExtent(width, level)} * levelExtent(height, level) *
+         4;
+}
+
+VkDeviceSize levelRangeBytes(uint32_t width, uint32_t height,
+                             uint32_t first_level, uint32_t last_level) {
+  VkDeviceSize bytes = 0;
+  for (uint32_t level = first_level; level < last_level; ++level) {
+    bytes += levelBytes(width, height, level);
+  }
+  return bytes;
+}
+
+uint32_t getTailLevel(uint32_t width, uint32_t height) {
+  uint32_t level = 0;
+  while (std::max(levelExtent(width, level), levelExtent(height, level)) >
+         TextureStreamer::kMipTailSize) {
+    ++level;
+  }
+  return level;
+}
+
+// Reads the next number of a PPM header, skipping whitespace and comments.
+uint32_t readPpmNumber(const MappedFile &file, size_t &position,
+                       const std::string &path) {
+  const uint8_t *data = file.data();
+  while (position < file.size()) {
+    if (data[position] == '#') {
+      while (position < file.size() && data[position] != '\n') {
+        ++position;
+      }
+    } else if (std::isspace(data[position])) {
+      ++position;
+    } else {
+      break;
+    }
+  }
+  uint32_t value = 0;
+  const size_t start = position;
+  while (position < file.size() && std::isdigit(data[position]) &&
+         value <= kMaxImageSize) {
+    value = value * 10 + (data[position] - '0');
+    ++position;
+  }
+  if (position == start) {
+    throw std::runtime_error(path + " is not a binary PPM image");
+  }
+  return value;
+}
+
+// Box-filters an RGBA8 level into the next smaller one. Odd edges repeat
+// their last texel.
+void downsample(const uint8_t *src, uint32_t width, uint32_t height,
+                uint8_t *dst) {
+  const uint32_t dst_width = levelExtent(width, 1);
+  const uint32_t dst_height = levelExtent(height, 1);
+  for (uint32_t y = 0; y < dst_height; ++y) {
+    const uint32_t y0 = std::min(2 * y, height - 1);
+    const uint32_t y1 = std::min(2 * y + 1, height - 1);
+    for (uint32_t x = 0; x < dst_width; ++x) {
+      const uint32_t x0 = std::min(2 * x, width - 1);
+      const uint32_t x1 = std::min(2 * x + 1, width - 1);
+      for (uint32_t channel = 0; channel < 4; ++channel) {
+        const uint32_t sum = src[(y0 * width + x0) * 4 + channel] +
+                             src[(y0 * width + x1) * 4 + channel] +
+                             src[(y1 * width + x0) * 4 + channel] +
+                             src[(y1 * width + x1) * 4 + channel];
+        dst[(y * dst_width + x) * 4 + channel] =
+            static_cast<uint8_t>((sum + 2) / 4);
+      }
+    }
+  }
+}
+} // namespace
+
+DecodedImage decodePpm(const std::string &path) {
+  const MappedFile file(path);
+  if (file.size() < 2 || std::memcmp(file.data(), "P6", 2) != 0) {
+    throw std::runtime_error(path + " is not a binary PPM image");
+  }
+  size_t position = 2;
+  DecodedImage image;
+  image.width = readPpmNumber(file, position, path);
+  image.height = readPpmNumber(file, position, path);
+  const uint32_t max_value = readPpmNumber(file, position, path);
+  if (image.width == 0 || image.height == 0 || image.width > kMaxImageSize ||
+      image.height > kMaxImageSize || max_value != 255) {
+    throw std::runtime_error(path + " has an unsupported PPM format");
+  }
+  // A single whitespace byte separates the header from the pixels.
+  ++position;
+  const size_t texel_count = size_t{image.width} * image.height;
+  if (position > file.size() || file.size() - position < texel_count * 3) {
+    throw std::runtime_error(path + " is truncated");
+  }
+  image.pixels.resize(texel_count * 4);
+  const uint8_t *src = file.data() + position;
+  for (size_t i = 0; i < texel_count; ++i) {
+    std::memcpy(&image.pixels[i * 4], &src[i * 3], 3);
+    image.pixels[i * 4 + 3] = 255;
+  }
+  return image;
+}
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  while ((std::max(width, height) >> levels) > 0) {
+    ++levels;
+  }
+  return levels;
+}
+
+TextureStreamer::TextureStreamer(DeviceAllocator &allocator,
+                                 BindlessTable &bindless,
+                                 const VkSampler &sampler, uint32_t frame_count,
+                                 VkDeviceSize budget, uint32_t thread_count,
+                                 VkDeviceSize staging_size)
+    : allocator_(allocator), bindless_(bindless), sampler_(sampler),
+      budget_(budget), staging_ring_(staging_size, frame_count),
+      retired_(frame_count) {
+  staging_ = createBuffer(allocator, staging_size,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  for (uint32_t i = 0; i < std::max(thread_count, 1u); ++i) {
+    threads_.emplace_back(&TextureStreamer::workerLoop, this);
+  }
+}
+
+TextureStreamer::~TextureStreamer() { stop(); }
+
+TextureStreamer::Handle TextureStreamer::add(const std::string &path,
+                                             const Material &material) {
+  const Handle handle = static_cast<Handle>(textures_.size());
+  StreamedTexture texture;
+  texture.path = path;
+  texture.material_data = material;
+  texture.material_data.texture = 0;
+  texture.material = bindless_.addMaterial(allocator_, texture.material_data);
+  texture.decoding = true;
+  textures_.push_back(std::move(texture));
+  queue({handle, path, std::nullopt, UINT32_MAX});
+  return handle;
+}
+
+void TextureStreamer::request(Handle texture, float screen_size) {
+  StreamedTexture &streamed = textures_[texture];
+  if (streamed.last_used != frame_number_) {
+    streamed.last_used = frame_number_;
+    streamed.screen_size = 0.0f;
+  }
+  streamed.screen_size = std::max(streamed.screen_size, screen_size);
+}
+
+void TextureStreamer::update(VkCommandBuffer command_buffer,
+                             uint32_t frame_index) {
+  current_frame_ = frame_index;
+  for (auto &texture : retired_[frame_index]) {
+    texture.destroy(allocator_);
+  }
+  retired_[frame_index].clear();
+  staging_ring_.beginFrame(frame_index);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &levels : decoded_) {
+      waiting_.push_back(std::move(levels));
+    }
+    decoded_.clear();
+  }
+
+  // Upload what has been decoded, as far as the staging ring allows.
+  std::deque<DecodedLevels> waiting;
+  bool staged = false;
+  for (auto &levels : waiting_) {
+    StreamedTexture &texture = textures_[levels.texture];
+    if (levels.failed) {
+      texture.decoding = false;
+      texture.failed = true;
+      if (texture.texture.image != VK_NULL_HANDLE) {
+        reserved_bytes_ -= levelRangeBytes(texture.width, texture.height,
+                                           levels.first_level,
+                                           levels.last_level);
+      }
+      continue;
+    }
+    if (texture.mip_levels == 0) {
+      texture.width = levels.width;
+      texture.height = levels.height;
+      texture.mip_levels = getMipLevelCount(levels.width, levels.height);
+      texture.tail_level = getTailLevel(levels.width, levels.height);
+    }
+    const bool upgrade = levels.first_level < texture.tail_level;
+    // Residency may have changed while decoding, e.g. by an eviction.
+    const uint32_t expected_level = texture.texture.image != VK_NULL_HANDLE
+                                        ? texture.resident_level
+                                        : texture.mip_levels;
+    if (levels.last_level != expected_level) {
+      texture.decoding = false;
+      if (upgrade) {
+        reserved_bytes_ -= levels.pixels.size();
+      }
+      continue;
+    }
+    const std::optional<VkDeviceSize> offset =
+        staging_ring_.allocate(levels.pixels.size(), 16);
+    if (!offset.has_value() && staging_ring_.empty()) {
+      // Too large to ever be staged: give the budget back and keep what is
+      // resident, or the default if not even the tail fits.
+      std::clog << "texture " << texture.path
+                << " does not fit the staging ring" << std::endl;
+      texture.decoding = false;
+      if (upgrade) {
+        reserved_bytes_ -= levels.pixels.size();
+      } else {
+        texture.failed = true;
+      }
+      continue;
+    }
+    if (!offset.has_value()) {
+      waiting.push_back(std::move(levels));
+      continue;
+    }
+    std::memcpy(static_cast<uint8_t *>(staging_.allocation.mapped) + *offset,
+                levels.pixels.data(), levels.pixels.size());
+    staged = true;
+    if (upgrade) {
+      reserved_bytes_ -= levels.pixels.size();
+    }
+    replaceImage(command_buffer, texture, levels.first_level, &levels,
+                 *offset);
+    texture.decoding = false;
+  }
+  waiting_ = std::move(waiting);
+  if (staged) {
+    allocator_.flush(staging_.allocation);
+  }
+
+  // Queue the larger levels of this frame's textures, making room for them
+  // or settling for smaller ones if the budget is tight. Larger uploads than
+  // the staging ring could never be staged.
+  for (Handle handle = 0; handle < textures_.size(); ++handle) {
+    StreamedTexture &texture = textures_[handle];
+    if (texture.decoding || texture.failed ||
+        texture.texture.image == VK_NULL_HANDLE ||
+        texture.last_used != frame_number_) {
+      continue;
+    }
+    uint32_t level = wantedLevel(texture);
+    while (level < texture.resident_level) {
+      const VkDeviceSize bytes = levelRangeBytes(
+          texture.width, texture.height, level, texture.resident_level);
+      if (bytes <= staging_ring_.capacity() &&
+          makeRoom(command_buffer, bytes)) {
+        reserved_bytes_ += bytes;
+        texture.decoding = true;
+        queue({handle, texture.path, level, texture.resident_level});
+        break;
+      }
+      ++level;
+    }
+  }
+
+  if (!barriers_.empty()) {
+    // Also covers the material updates.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, static_cast<uint32_t>(barriers_.size()),
+                         barriers_.data());
+    barriers_.clear();
+  }
+  ++frame_number_;
+}
+
+TextureStreamingStatistics TextureStreamer::statistics() const {
+  TextureStreamingStatistics statistics;
+  statistics.texture_count = static_cast<uint32_t>(textures_.size());
+  for (const auto &texture : textures_) {
+    if (texture.texture.image != VK_NULL_HANDLE &&
+        texture.resident_level < texture.tail_level) {
+      ++statistics.streamed_count;
+    }
+    if (texture.decoding) {
+      ++statistics.pending_decodes;
+    }
+  }
+  statistics.evictions = evictions_;
+  statistics.resident_bytes = resident_bytes_;
+  statistics.budget_bytes = budget_;
+  return statistics;
+}
+
+void TextureStreamer::destroy() {
+  stop();
+  for (auto &texture : textures_) {
+    if (texture.texture.image != VK_NULL_HANDLE) {
+      texture.texture.destroy(allocator_);
+    }
+  }
+  textures_.clear();
+  for (auto &retired : retired_) {
+    for (auto &texture : retired) {
+      texture.destroy(allocator_);
+    }
+    retired.clear();
+  }
+  staging_.destroy(allocator_);
+}
+
+void TextureStreamer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void TextureStreamer::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_ready_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    const DecodeJob job = std::move(jobs_.front());
+    jobs_.pop_front();
+    lock.unlock();
+    DecodedLevels levels = decode(job);
+    lock.lock();
+    decoded_.push_back(std::move(levels));
+  }
+}
+
+TextureStreamer::DecodedLevels TextureStreamer::decode(const DecodeJob &job) {
+  DecodedLevels levels{job.texture, 0, 0,
+                       job.first_level.value_or(UINT32_MAX), job.last_level};
+  DecodedImage image;
+  try {
+    image = decodePpm(job.path);
+  } catch (const std::exception &e) {
+    // Keep drawing with the default texture rather than retrying.
+    std::clog << "texture decoding failed: " << e.what() << std::endl;
+    levels.failed = true;
+    return levels;
+  }
+  levels.width = image.width;
+  levels.height = image.height;
+  levels.first_level =
+      job.first_level.value_or(getTailLevel(image.width, image.height));
+  levels.last_level = std::min(
+      job.last_level, getMipLevelCount(image.width, image.height));
+  levels.pixels.reserve(levelRangeBytes(image.width, image.height,
+                                        levels.first_level,
+                                        levels.last_level));
+
+  // Every level is filtered from the one above it, so the chain is built
+  // from the top even when only the tail is wanted.
+  std::vector<uint8_t> current = std::move(image.pixels);
+  std::vector<uint8_t> next;
+  for (uint32_t level = 0; level < levels.last_level; ++level) {
+    if (level >= levels.first_level) {
+      levels.pixels.insert(levels.pixels.end(), current.begin(),
+                           current.end());
+    }
+    if (level + 1 < levels.last_level) {
+      next.resize(levelBytes(image.width, image.height, level + 1));
+      downsample(current.data(), levelExtent(image.width, level),
+                 levelExtent(image.height, level), next.data());
+      std::swap(current, next);
+    }
+  }
+  return levels;
+}
+
+uint32_t TextureStreamer::wantedLevel(const StreamedTexture &texture) {
+  if (texture.screen_size <= 0.0f) {
+    return texture.tail_level;
+  }
+  const float size =
+      static_cast<float>(std::max(texture.width, texture.height));
+  const float level = std::floor(std::log2(size / texture.screen_size));
+  return static_cast<uint32_t>(
+      std::clamp(level, 0.0f, static_cast<float>(texture.tail_level)));
+}
+
+void TextureStreamer::replaceImage(VkCommandBuffer command_buffer,
+                                   StreamedTexture &texture,
+                                   uint32_t first_level,
+                                   const DecodedLevels *levels,
+                                   VkDeviceSize staging_offset) {
+  const VkDevice &device = allocator_.device();
+  const uint32_t level_count = texture.mip_levels - first_level;
+  Texture image = createTextureImage(
+      allocator_, levelExtent(texture.width, first_level),
+      levelExtent(texture.height, first_level), level_count,
+      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+          VK_IMAGE_USAGE_SAMPLED_BIT);
+  Texture &old = texture.texture;
+  // Earlier frames may still sample the old image and read the material.
+  std::vector<VkImageMemoryBarrier> barriers = {getLayoutBarrier(
+      image.image, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+      level_count)};
+  if (old.image != VK_NULL_HANDLE) {
+    barriers.push_back(getLayoutBarrier(
+        old.image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0, VK_ACCESS_TRANSFER_READ_BIT,
+        old.mip_levels));
+  }
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+
+  const uint32_t upload_end = levels != nullptr ? levels->last_level
+                                                : first_level;
+  std::vector<VkBufferImageCopy> uploads;
+  VkDeviceSize offset = staging_offset;
+  for (uint32_t level = first_level; level < upload_end; ++level) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - first_level,
+                               0, 1};
+    region.imageExtent = {levelExtent(texture.width, level),
+                          levelExtent(texture.height, level), 1};
+    uploads.push_back(region);
+    offset += levelBytes(texture.width, texture.height, level);
+  }
+  if (!uploads.empty()) {
+    vkCmdCopyBufferToImage(command_buffer, staging_.buffer, image.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(uploads.size()),
+                           uploads.data());
+  }
+  std::vector<VkImageCopy> copies;
+  if (old.image != VK_NULL_HANDLE) {
+    for (uint32_t level = std::max(upload_end, texture.resident_level);
+         level < texture.mip_levels; ++level) {
+      VkImageCopy region{};
+      region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT,
+                               level - texture.resident_level, 0, 1};
+      region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - first_level,
+                               0, 1};
+      region.extent = {levelExtent(texture.width, level),
+                       levelExtent(texture.height, level), 1};
+      copies.push_back(region);
+    }
+    vkCmdCopyImage(command_buffer, old.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   static_cast<uint32_t>(copies.size()), copies.data());
+  }
+  barriers_.push_back(getLayoutBarrier(
+      image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT, level_count));
+  image.view = createImageView(image.image, image.format, device,
+                               VK_IMAGE_ASPECT_COLOR_BIT, 0, level_count);
+
+  // A fresh slot, as the current one may be read by frames in flight.
+  const uint32_t slot = bindless_.addTexture(image.view, sampler_);
+  if (texture.slot != 0) {
+    bindless_.removeTexture(texture.slot);
+  }
+  texture.slot = slot;
+  texture.material_data.texture = slot;
+  bindless_.recordMaterialUpdate(command_buffer, texture.material,
+                                 texture.material_data);
+
+  resident_bytes_ += image.allocation.size;
+  if (old.image != VK_NULL_HANDLE) {
+    resident_bytes_ -= old.allocation.size;
+    retired_[current_frame_].push_back(old);
+  }
+  old = image;
+  texture.resident_level = first_level;
+  texture.resident_since = frame_number_;
+}
+
+bool TextureStreamer::makeRoom(VkCommandBuffer command_buffer,
+                               VkDeviceSize bytes) {
+  const auto fits = [&] {
+    return resident_bytes_ + reserved_bytes_ + bytes <= budget_;
+  };
+  if (fits()) {
+    return true;
+  }
+  std::vector<StreamedTexture *> candidates;
+  for (auto &texture : textures_) {
+    if (!texture.decoding && texture.texture.image != VK_NULL_HANDLE &&
+        texture.resident_level < texture.tail_level &&
+        texture.last_used != frame_number_ &&
+        texture.resident_since != frame_number_) {
+      candidates.push_back(&texture);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const StreamedTexture *a, const StreamedTexture *b) {
+              return a->last_used < b->last_used;
+            });
+  for (StreamedTexture *texture : candidates) {
+    if (fits()) {
+      break;
+    }
+    replaceImage(command_buffer, *texture, texture->tail_level, nullptr, 0);
+    ++evictions_;
+  }
+  return fits();
+}
+
+void TextureStreamer::queue(DecodeJob job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  work_ready_.notify_one();
+}
+} // namespace cg
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "bindless.h"
+#include "buffer.h"
+#include "device_memory.h"
+#include "texture.h"
+
+namespace cg {
+// Tightly packed RGBA8 pixels.
+struct DecodedImage {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> pixels;
+};
+
+// Decodes a binary PPM (P6) image with 8-bit channels.
+DecodedImage decodePpm(const std::string &path);
+
+// Levels of a full mip chain for an image of the given size.
+uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+struct TextureStreamingStatistics {
+  uint32_t texture_count = 0;
+  // Textures with more than their mip tail resident.
+  uint32_t streamed_count = 0;
+  uint32_t pending_decodes = 0;
+  uint64_t evictions = 0;
+  VkDeviceSize resident_bytes = 0;
+  VkDeviceSize budget_bytes = 0;
+};
+
+// Streams image files into bindless textures without stalling the frame.
+// Worker threads decode files and build their mip chains; the recording
+// thread copies the results through a staging ring into the frame's command
+// buffer. Each texture first gets its mip tail, the levels of at most
+// kMipTailSize texels across, and then the larger levels its draws ask for,
+// as long as they fit the memory budget. When they do not, the textures used
+// longest ago drop back to their tails.
+//
+// A texture's image only holds its resident levels. Changing residency
+// creates a new image, copies the levels both have on the GPU and points the
+// texture's material at it; the old image is destroyed once the frames that
+// may still read it have completed. Not thread-safe: call everything on the
+// recording thread.
+class TextureStreamer {
+public:
+  using Handle = uint32_t;
+
+  static constexpr uint32_t kMipTailSize = 64;
+  static constexpr VkDeviceSize kDefaultStagingSize = 64ull << 20;
+
+  // sampler must outlive the streamer.
+  TextureStreamer(DeviceAllocator &allocator, BindlessTable &bindless,
+                  const VkSampler &sampler, uint32_t frame_count,
+                  VkDeviceSize budget, uint32_t thread_count = 2,
+                  VkDeviceSize staging_size = kDefaultStagingSize);
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  // Queues the file's mip tail for decoding. Until it is resident the
+  // texture's material samples the bindless default texture in slot 0.
+  Handle add(const std::string &path, const Material &material = {});
+  // The material slot drawing the texture. Stays the same for the
+  // texture's lifetime.
+  uint32_t material(Handle texture) const {
+    return textures_[texture].material;
+  }
+
+  // Marks the texture as used this frame, drawn screen_size pixels across,
+  // which selects the largest level worth streaming in.
+  void request(Handle texture, float screen_size);
+
+  // Records this frame's uploads, evictions and material updates into
+  // command_buffer, outside a render pass and before any draw sampling the
+  // textures. Call once per frame after waiting on the slot's fence.
+  void update(VkCommandBuffer command_buffer, uint32_t frame_index);
+
+  TextureStreamingStatistics statistics() const;
+
+  // Stops the decode threads and destroys every texture. The device must be
+  // idle.
+  void destroy();
+
+private:
+  struct StreamedTexture {
+    std::string path;
+    uint32_t material;
+    Material material_data;
+    // Size and mip tail, known once the first decode has finished.
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mip_levels = 0;
+    uint32_t tail_level = 0;
+    // Holds levels [resident_level, mip_levels); no image until the tail
+    // has been decoded.
+    Texture texture;
+    uint32_t resident_level = UINT32_MAX;
+    // Frame the image was created in; it is not in its final layout before
+    // the end of that frame's update().
+    uint64_t resident_since = 0;
+    uint32_t slot = 0;
+    // Largest size requested in frame last_used.
+    float screen_size = 0.0f;
+    uint64_t last_used = 0;
+    bool decoding = false;
+    // Set when decoding failed; the texture then keeps the default.
+    bool failed = false;
+  };
+
+  // Levels [first_level, last_level) of a texture, or its mip tail when
+  // first_level is empty.
+  struct DecodeJob {
+    Handle texture;
+    std::string path;
+    std::optional<uint32_t> first_level;
+    uint32_t last_level;
+  };
+
+  struct DecodedLevels {
+    Handle texture;
+    uint32_t width;
+    uint32_t height;
+    uint32_t first_level;
+    uint32_t last_level;
+    // Levels back to back, each tightly packed.
+    std::vector<uint8_t> pixels;
+    bool failed = false;
+  };
+
+  void stop();
+  void workerLoop();
+  static DecodedLevels decode(const DecodeJob &job);
+  // The largest level worth having for the texture's requested size.
+  static uint32_t wantedLevel(const StreamedTexture &texture);
+
+  // Moves texture to an image holding levels [first_level, mip_levels).
+  // Levels below the old resident level come from levels, staged at
+  // staging_offset; the rest are copied from the old image.
+  void replaceImage(VkCommandBuffer command_buffer, StreamedTexture &texture,
+                    uint32_t first_level, const DecodedLevels *levels,
+                    VkDeviceSize staging_offset);
+  // Drops textures not used this frame back to their tails, least recently
+  // used first, until bytes more fit the budget. Returns whether they do.
+  bool makeRoom(VkCommandBuffer command_buffer, VkDeviceSize bytes);
+  void queue(DecodeJob job);
+
+  DeviceAllocator &allocator_;
+  BindlessTable &bindless_;
+  VkSampler sampler_;
+  VkDeviceSize budget_;
+
+  std::vector<StreamedTexture> textures_;
+  VkDeviceSize resident_bytes_ = 0;
+  // Budget held by upgrades still decoding.
+  VkDeviceSize reserved_bytes_ = 0;
+  uint64_t frame_number_ = 1;
+  uint64_t evictions_ = 0;
+  // Decoded levels waiting for staging space.
+  std::deque<DecodedLevels> waiting_;
+
+  Buffer staging_;
+  RingAllocator staging_ring_;
+  // Move this frame's new images to SHADER_READ_ONLY_OPTIMAL.
+  std::vector<VkImageMemoryBarrier> barriers_;
+  // Images replaced in each frame slot, destroyed when it comes around
+  // again.
+  std::vector<std::vector<Texture>> retired_;
+  uint32_t current_frame_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::deque<DecodeJob> jobs_;
+  std::vector<DecodedLevels> decoded_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+} // namespace cg
@@ -0,0 +1,269 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CG_VISIBILITY_X86
+#include <immintrin.h>
+#endif
+
+namespace cg {
+namespace {
+// Spheres per job of the parallel cullSpheres(); large enough that a job
+// outweighs its scheduling.
+constexpr uint32_t kCullJobSize = 16384;
+
+Plane normalize(float x, float y, float z, float offset) {
+  const float length = std::sqrt(x * x + y * y + z * z);
+  return {{x / length, y / length, z / length}, offset / length};
+}
+
+// Stores index i for every set bit i of mask, offset by base, without
+// branching on the bits.
+uint32_t appendVisible(uint32_t mask, uint32_t lanes, uint32_t base,
+                       uint32_t *visible, uint32_t visible_count) {
+  for (uint32_t lane = 0; lane < lanes; ++lane) {
+    visible[visible_count] = base + lane;
+    visible_count += (mask >> lane) & 1;
+  }
+  return visible_count;
+}
+
+uint32_t cullScalar(const Frustum &frustum, const BoundsArray &bounds,
+                    uint32_t first, uint32_t end, uint32_t *visible,
+                    uint32_t visible_count) {
+  for (uint32_t i = first; i < end; ++i) {
+    bool inside = true;
+    for (const auto &plane : frustum) {
+      const float distance = plane.normal[0] * bounds.x()[i] +
+                             plane.normal[1] * bounds.y()[i] +
+                             plane.normal[2] * bounds.z()[i] + plane.offset;
+      inside &= distance >= -bounds.radius()[i];
+    }
+    visible[visible_count] = i;
+    visible_count += inside ? 1 : 0;
+  }
+  return visible_count;
+}
+
+#ifdef CG_VISIBILITY_X86
+// The vector paths evaluate the same expression as cullScalar(), in the
+// same order and without fused multiply-adds, so the paths agree exactly.
+__attribute__((target("sse2"))) uint32_t
+cullSse2(const Frustum &frustum, const BoundsArray &bounds, uint32_t first,
+         uint32_t end, uint32_t *visible) {
+  __m128 planes[6][4];
+  for (size_t p = 0; p < frustum.size(); ++p) {
+    for (int c = 0; c < 3; ++c) {
+      planes[p][c] = _mm_set1_ps(frustum[p].normal[c]);
+    }
+    planes[p][3] = _mm_set1_ps(frustum[p].offset);
+  }
+  uint32_t visible_count = 0;
+  uint32_t i = first;
+  for (; i + 4 <= end; i += 4) {
+    const __m128 x = _mm_loadu_ps(bounds.x() + i);
+    const __m128 y = _mm_loadu_ps(bounds.y() + i);
+    const __m128 z = _mm_loadu_ps(bounds.z() + i);
+    const __m128 negative_radius =
+        _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(bounds.radius() + i));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (const auto &plane : planes) {
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[0], x),
+                                _mm_mul_ps(plane[1], y)),
+                     _mm_mul_ps(plane[2], z)),
+          plane[3]);
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+    }
+    visible_count = appendVisible(_mm_movemask_ps(inside), 4, i, visible,
+                                  visible_count);
+  }
+  return cullScalar(frustum, bounds, i, end, visible, visible_count);
+}
+
+__attribute__((target("avx2"))) uint32_t
+cullAvx2(const Frustum &frustum, const BoundsArray &bounds, uint32_t first,
+         uint32_t end, uint32_t *visible) {
+  __m256 planes[6][4];
+  for (size_t p = 0; p < frustum.size(); ++p) {
+    for (int c = 0; c < 3; ++c) {
+      planes[p][c] = _mm256_set1_ps(frustum[p].normal[c]);
+    }
+    planes[p][3] = _mm256_set1_ps(frustum[p].offset);
+  }
+  // Lane indices, and the permutation moving the lanes of each 8-bit mask
+  // to the front, four bits per lane.
+  static const std::array<uint32_t, 256> kCompaction = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t mask = 0; mask < 256; ++mask) {
+      uint32_t packed = 0;
+      uint32_t count = 0;
+      for (uint32_t lane = 0; lane < 8; ++lane) {
+        if (mask & (1u << lane)) {
+          packed |= lane << (4 * count++);
+        }
+      }
+      table[mask] = packed;
+    }
+    return table;
+  }();
+  const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  uint32_t visible_count = 0;
+  uint32_t i = first;
+  for (; i + 8 <= end; i += 8) {
+    const __m256 x = _mm256_loadu_ps(bounds.x() + i);
+    const __m256 y = _mm256_loadu_ps(bounds.y() + i);
+    const __m256 z = _mm256_loadu_ps(bounds.z() + i);
+    const __m256 negative_radius = _mm256_sub_ps(
+        _mm256_setzero_ps(), _mm256_loadu_ps(bounds.radius() + i));
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (const auto &plane : planes) {
+      const __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane[0], x),
+                                      _mm256_mul_ps(plane[1], y)),
+                        _mm256_mul_ps(plane[2], z)),
+          plane[3]);
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+    }
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+    const uint32_t count = static_cast<uint32_t>(__builtin_popcount(mask));
+    if (count == 0) {
+      continue;
+    }
+    const __m256i permutation = _mm256_and_si256(
+        _mm256_srlv_epi32(_mm256_set1_epi32(kCompaction[mask]), shifts),
+        _mm256_set1_epi32(7));
+    const __m256i indices = _mm256_permutevar8x32_epi32(
+        _mm256_add_epi32(_mm256_set1_epi32(i), lanes), permutation);
+    // Only the first count lanes may be stored: visible has no room past
+    // the spheres tested so far.
+    const __m256i store_mask = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(static_cast<int>(count)), lanes);
+    _mm256_maskstore_epi32(reinterpret_cast<int *>(visible + visible_count),
+                           store_mask, indices);
+    visible_count += count;
+  }
+  return cullScalar(frustum, bounds, i, end, visible, visible_count);
+}
+#endif
+} // namespace
+
+Frustum getViewFrustum(const FrameUniforms &uniforms) {
+  // clip.x = view[0] * x + view[2] * y + view_translation[0], and likewise
+  // for y with view[1] and view[3].
+  const float *view = uniforms.view;
+  const float *translation = uniforms.view_translation;
+  return {
+      normalize(view[0], view[2], 0.0f, translation[0] + 1.0f),
+      normalize(-view[0], -view[2], 0.0f, 1.0f - translation[0]),
+      normalize(view[1], view[3], 0.0f, translation[1] + 1.0f),
+      normalize(-view[1], -view[3], 0.0f, 1.0f - translation[1]),
+      normalize(0.0f, 0.0f, 1.0f, 0.0f),
+      normalize(0.0f, 0.0f, -1.0f, 1.0f),
+  };
+}
+
+void BoundsArray::clear() {
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  radius_.clear();
+}
+
+void BoundsArray::reserve(size_t count) {
+  x_.reserve(count);
+  y_.reserve(count);
+  z_.reserve(count);
+  radius_.reserve(count);
+}
+
+void BoundsArray::add(float x, float y, float z, float radius) {
+  x_.push_back(x);
+  y_.push_back(y);
+  z_.push_back(z);
+  radius_.push_back(radius);
+}
+
+const char *getCullPathName(CullPath path) {
+  switch (path) {
+  case CullPath::kScalar:
+    return "scalar";
+  case CullPath::kSse2:
+    return "sse2";
+  case CullPath::kAvx2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+CullPath getBestCullPath() {
+#ifdef CG_VISIBILITY_X86
+  static const CullPath path = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return CullPath::kAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      return CullPath::kSse2;
+    }
+    return CullPath::kScalar;
+  }();
+  return path;
+#else
+  return CullPath::kScalar;
+#endif
+}
+
+uint32_t cullSpheres(const Frustum &frustum, const BoundsArray &bounds,
+                     uint32_t first, uint32_t count, uint32_t *visible,
+                     CullPath path) {
+  const uint32_t end = first + count;
+  switch (path) {
+#ifdef CG_VISIBILITY_X86
+  case CullPath::kSse2:
+    return cullSse2(frustum, bounds, first, end, visible);
+  case CullPath::kAvx2:
+    return cullAvx2(frustum, bounds, first, end, visible);
+#endif
+  default:
+    return cullScalar(frustum, bounds, first, end, visible, 0);
+  }
+}
+
+void cullSpheres(const Frustum &frustum, const BoundsArray &bounds,
+                 std::vector<uint32_t> &visible, JobSystem *jobs) {
+  const uint32_t count = bounds.size();
+  visible.resize(count);
+  if (jobs == nullptr || count <= kCullJobSize) {
+    visible.resize(cullSpheres(frustum, bounds, 0, count, visible.data()));
+    return;
+  }
+  // Each job compacts into the start of its own range, which are then
+  // moved together.
+  const uint32_t job_count = (count + kCullJobSize - 1) / kCullJobSize;
+  std::vector<uint32_t> job_visible(job_count);
+  jobs->parallelFor(job_count, 1, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t job = begin; job < end; ++job) {
+      const uint32_t first = job * kCullJobSize;
+      job_visible[job] =
+          cullSpheres(frustum, bounds, first,
+                      std::min(kCullJobSize, count - first),
+                      visible.data() + first);
+    }
+  });
+  uint32_t visible_count = job_visible[0];
+  for (uint32_t job = 1; job < job_count; ++job) {
+    std::memmove(visible.data() + visible_count,
+                 visible.data() + job * kCullJobSize,
+                 job_visible[job] * sizeof(uint32_t));
+    visible_count += job_visible[job];
+  }
+  visible.resize(visible_count);
+}
+} // namespace cg
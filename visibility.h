@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "instancing.h"
+#include "job_system.h"
+
+namespace cg {
+// Points p with dot(normal, p) + offset >= 0 are inside. Normalized, so the
+// left-hand side is the signed distance.
+struct Plane {
+  float normal[3];
+  float offset;
+};
+
+using Frustum = std::array<Plane, 6>;
+
+// The world-space volume the view of uniforms maps into clip space: x and y
+// in [-1, 1] and, as the depth of InstanceData, z in [0, 1].
+Frustum getViewFrustum(const FrameUniforms &uniforms);
+
+// Bounding spheres stored as one array per component, so that several are
+// tested at once with whole vector loads.
+class BoundsArray {
+public:
+  void clear();
+  void reserve(size_t count);
+  void add(float x, float y, float z, float radius);
+
+  uint32_t size() const { return static_cast<uint32_t>(x_.size()); }
+  const float *x() const { return x_.data(); }
+  const float *y() const { return y_.data(); }
+  const float *z() const { return z_.data(); }
+  const float *radius() const { return radius_.data(); }
+
+private:
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<float> radius_;
+};
+
+// Instruction sets cullSpheres() can test with. All give the same results.
+enum class CullPath {
+  kScalar,
+  // Four spheres at a time.
+  kSse2,
+  // Eight spheres at a time.
+  kAvx2,
+};
+
+const char *getCullPathName(CullPath path);
+// The widest path the CPU supports.
+CullPath getBestCullPath();
+
+// Writes the indices of the spheres in [first, first + count) that are at
+// least partly inside frustum to visible, in increasing order, and returns
+// how many there are. visible needs room for count indices.
+uint32_t cullSpheres(const Frustum &frustum, const BoundsArray &bounds,
+                     uint32_t first, uint32_t count, uint32_t *visible,
+                     CullPath path = getBestCullPath());
+// Replaces visible with the indices of every sphere of bounds that is at
+// least partly inside frustum, in increasing order, testing ranges of them
+// on jobs, if given.
+void cullSpheres(const Frustum &frustum, const BoundsArray &bounds,
+                 std::vector<uint32_t> &visible, JobSystem *jobs = nullptr);
+} // namespace cg